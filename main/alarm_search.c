@@ -0,0 +1,173 @@
+#include <freertos/FreeRTOS.h>
+#include <driver/gpio.h>
+#include <esp_rom_sys.h>        // for esp_rom_delay_us()
+#include <onewire.h>
+#include <ds18x20.h>
+
+#include "alarm_search.h"
+
+#define DS18X20_ALARM_SEARCH        0xec
+#define DS18X20_WRITE_SCRATCHPAD    0x4e
+#define DS18B20_CONFIG_12BIT        0x7f    // the ds18x20 library always waits for a 12 bit conversion
+
+// state of an alarm search, as per Maxim application note 187
+struct alarm_search_t {
+    uint8_t rom[8];
+    int last_discrepancy;
+    bool last_device_found;
+};
+
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+// The onewire library only exposes byte-level I/O and its search is hard-wired
+// to the SEARCH ROM command, so the alarm search needs its own bit slots. The
+// timings match those used by the library.
+
+/// @brief Reads a single bit time slot.
+/// @param pin the 1-Wire bus GPIO (already set up by onewire_reset())
+/// @return the bit value
+static int read_bit(gpio_num_t pin) {
+    portENTER_CRITICAL(&mux);
+    gpio_set_level(pin, 0);
+    esp_rom_delay_us(2);
+    gpio_set_level(pin, 1);
+    esp_rom_delay_us(11);
+    int r = gpio_get_level(pin);
+    portEXIT_CRITICAL(&mux);
+    esp_rom_delay_us(48);
+    return r;
+}
+
+
+/// @brief Writes a single bit time slot.
+/// @param pin the 1-Wire bus GPIO (already set up by onewire_reset())
+/// @param v the bit value
+static void write_bit(gpio_num_t pin, int v) {
+    portENTER_CRITICAL(&mux);
+    gpio_set_level(pin, 0);
+    if (v) {
+        esp_rom_delay_us(10);
+        gpio_set_level(pin, 1);
+        portEXIT_CRITICAL(&mux);
+        esp_rom_delay_us(55);
+    } else {
+        esp_rom_delay_us(65);
+        gpio_set_level(pin, 1);
+        portEXIT_CRITICAL(&mux);
+        esp_rom_delay_us(5);
+    }
+}
+
+
+/// @brief Finds the next device on the bus with its alarm flag set.
+/// @param pin the 1-Wire bus GPIO
+/// @param search the search state
+/// @param addr where to store the address of the device
+/// @return true if a device was found, otherwise false
+static bool alarm_search_next(gpio_num_t pin, struct alarm_search_t *search, ds18x20_addr_t *addr) {
+    int last_zero = 0;
+
+    if (search->last_device_found || !onewire_reset(pin)) {
+        return false;
+    }
+    onewire_write(pin, DS18X20_ALARM_SEARCH);
+
+    for (int bit_number = 1; bit_number <= 64; bit_number += 1) {
+        int byte = (bit_number - 1) / 8;
+        uint8_t mask = 1 << ((bit_number - 1) % 8);
+
+        int id_bit = read_bit(pin);
+        int cmp_id_bit = read_bit(pin);
+        int direction;
+
+        if (id_bit && cmp_id_bit) {
+            return false;                   // no devices in alarm (or they dropped off the bus)
+        } else if (id_bit != cmp_id_bit) {
+            direction = id_bit;             // all remaining devices agree on this bit
+        } else {
+            // discrepancy: follow the same path as last time until we reach the last discrepancy
+            if (bit_number < search->last_discrepancy) {
+                direction = ((search->rom[byte] & mask) != 0);
+            } else {
+                direction = (bit_number == search->last_discrepancy);
+            }
+            if (direction == 0) {
+                last_zero = bit_number;
+            }
+        }
+
+        if (direction) {
+            search->rom[byte] |= mask;
+        } else {
+            search->rom[byte] &= ~mask;
+        }
+        write_bit(pin, direction);
+    }
+
+    search->last_discrepancy = last_zero;
+    if (last_zero == 0) {
+        search->last_device_found = true;
+    }
+
+    if (onewire_crc8(search->rom, 7) != search->rom[7]) {
+        return false;
+    }
+
+    // same byte order as onewire_search_next(): family code in the least significant byte
+    *addr = 0;
+    for (int i = 7; i >= 0; i -= 1) {
+        *addr = (*addr << 8) | search->rom[i];
+    }
+    return true;
+}
+
+
+/// @brief Lists the devices whose last conversion was outside their TL/TH alarm window.
+/// @param pin the 1-Wire bus GPIO
+/// @param addr_list where to store the device addresses
+/// @param addr_count the size of `addr_list`
+/// @param found where to store the number of devices in alarm (may exceed `addr_count`)
+/// @return ESP_OK, or ESP_ERR_INVALID_RESPONSE if there are no devices on the bus
+esp_err_t alarm_search_devices(gpio_num_t pin, ds18x20_addr_t *addr_list, size_t addr_count, size_t *found) {
+    struct alarm_search_t search = { 0 };
+    ds18x20_addr_t addr;
+
+    *found = 0;
+    if (!onewire_reset(pin)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    while (alarm_search_next(pin, &search, &addr)) {
+        if (*found < addr_count) {
+            addr_list[*found] = addr;
+        }
+        *found += 1;
+    }
+    return ESP_OK;
+}
+
+
+/// @brief Programs the TL/TH alarm registers of a device.
+///
+/// The device flags an alarm after any conversion whose integer part is
+/// less than or equal to `tl` or greater than or equal to `th`. The registers
+/// are only written to the scratchpad, not copied to EEPROM.
+///
+/// @param pin the 1-Wire bus GPIO
+/// @param addr the device address
+/// @param tl the low alarm threshold in degrees C
+/// @param th the high alarm threshold in degrees C
+/// @return ESP_OK, or ESP_ERR_INVALID_RESPONSE if the device didn't respond
+esp_err_t alarm_set_window(gpio_num_t pin, ds18x20_addr_t addr, int8_t tl, int8_t th) {
+    uint8_t buf[3] = { (uint8_t)th, (uint8_t)tl, DS18B20_CONFIG_12BIT };
+    size_t len = ((uint8_t)addr == DS18B20_FAMILY_ID) ? 3 : 2;    // the DS18S20 has no config register
+
+    if (!onewire_reset(pin)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    onewire_select(pin, addr);
+    onewire_write(pin, DS18X20_WRITE_SCRATCHPAD);
+    onewire_write_bytes(pin, buf, len);
+    return ESP_OK;
+}
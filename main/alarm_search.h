@@ -0,0 +1,10 @@
+#ifndef ALARM_SEARCH_H
+#define ALARM_SEARCH_H
+
+#include <stdint.h>
+#include <ds18x20.h>
+
+esp_err_t alarm_search_devices(gpio_num_t pin, ds18x20_addr_t *addr_list, size_t addr_count, size_t *found);
+esp_err_t alarm_set_window(gpio_num_t pin, ds18x20_addr_t addr, int8_t tl, int8_t th);
+
+#endif // ALARM_SEARCH_H
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>             // for qsort()
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_cpu.h>            // for esp_cpu_get_cycle_count()
+
+#include "defines.h"
+#include "types.h"
+#include "ui_task.h"
+#include "lcd.h"
+#include "power.h"
+#include "lowpower.h"
+#include "display_task.h"
+#include "profile.h"
+#include "bench.h"
+
+#if BENCH_ENABLE
+
+// Microbenchmarks for the code on the UI/control path. Build with BENCH_ENABLE
+// set to 1 and app_main() runs these instead of the UI and sensor tasks. Each
+// result is printed as one line of JSON, eg.
+//
+//  {"bench":"find_sensor","iters":256,"min":312,"median":318,"max":901,"unit":"cycles","mhz":240}
+//
+// so that a log can be compared against an earlier one with a script.
+
+// profiles that must be rejected: a sign, out of range, and numbers that used to overflow
+static const char *const bad_profiles[] = {
+    "hold -0.5 1d",
+    "hold 40.1 1d",
+    "hold 2147483647 1d",
+    "hold 20 2982617d",
+    "hold 20 1093h",
+    "hold 20 65536m"
+};
+
+static uint32_t samples[BENCH_ITERATIONS];
+static volatile int sink;       // stops the compiler discarding results
+
+
+static int compare_samples(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/// @brief Prints a result line, with any extra fields the caller wants to add.
+/// @param name the name of the benchmark
+/// @param iters the number of samples
+/// @param extra extra JSON fields, starting with a comma, or ""
+static void report(const char *name, int iters, const char *extra) {
+    qsort(samples, iters, sizeof(samples[0]), compare_samples);
+    printf("{\"bench\":\"%s\",\"iters\":%d,\"min\":%lu,\"median\":%lu,\"max\":%lu,\"unit\":\"cycles\",\"mhz\":%d%s}\n",
+           name, iters,
+           (unsigned long)samples[0], (unsigned long)samples[iters / 2], (unsigned long)samples[iters - 1],
+           PM_MAX_CPU_FREQ_MHZ, extra);
+}
+
+
+/// @brief Makes up a set of sensor readings.
+/// @param pTemp where to store the readings
+/// @param num_sensors the number of sensors
+static void make_temp_data(struct temp_data_t *pTemp, int num_sensors) {
+    pTemp->num_sensors = num_sensors;
+    pTemp->addr[0] = 0;                             // the 'off' entry, as in sensor_task
+    pTemp->temp[0] = UNDEFINED_TEMP;
+    for (int i = 1; i < num_sensors; i += 1) {
+        pTemp->addr[i] = 0x5a00000000000028ull | ((uint64_t)i << 8);
+        pTemp->temp[i] = 4.0 + i * 1.7;
+    }
+}
+
+
+/// @brief Waits for the display task to finish drawing.
+/// @return the number of writes to the PCF8574 while we waited
+static uint32_t wait_for_display(uint32_t writes_before) {
+    struct display_stats_t stats;
+    uint32_t last = writes_before;
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(20));
+        display_get_stats(&stats);
+        if (stats.i2c_writes == last && uxQueueMessagesWaiting(display_queue) == 0) {
+            return stats.i2c_writes - writes_before;
+        }
+        last = stats.i2c_writes;
+    }
+}
+
+
+/// @brief Runs each benchmark in turn and prints the results.
+/// @param pParams the parameters passed by xTaskCreate(): not used.
+void bench_task(void *pParams) {
+    static struct temp_data_t temp;     // the UI keeps a pointer to it
+    struct display_stats_t stats;
+    uint32_t start;
+    char extra[64];
+
+    lowpower_bus_acquire();         // keep the CPU at full speed so that cycles mean the same thing throughout
+    lcd_init();
+    make_temp_data(&temp, MAX_TEMP_SENSORS);
+    ui_bench_load(&temp);
+
+    for (int i = 0; i < BENCH_ITERATIONS; i += 1) {
+        start = esp_cpu_get_cycle_count();
+        ui_bench_update_sensor_temps();
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    report("update_sensor_temps", BENCH_ITERATIONS, "");
+
+    for (int i = 0; i < BENCH_ITERATIONS; i += 1) {
+        ds18x20_addr_t addr = temp.addr[i % MAX_TEMP_SENSORS];
+        start = esp_cpu_get_cycle_count();
+        sink = ui_bench_find_sensor(addr);
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    report("find_sensor", BENCH_ITERATIONS, "");
+
+    for (int i = 0; i < BENCH_ITERATIONS; i += 1) {
+        int value = (i % 2) ? UNDEFINED_TEMP : -99 + i;
+        start = esp_cpu_get_cycle_count();
+        ui_bench_format_temp(value);
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    report("value_to_temp_str", BENCH_ITERATIONS, "");
+
+    // a request for both cooling and heating is ignored, so the relays never switch
+    for (int i = 0; i < BENCH_ITERATIONS; i += 1) {
+        bool both = (i / 2) % 2;
+        start = esp_cpu_get_cycle_count();
+        power_update(i % 2, both, both);
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    report("power_update", BENCH_ITERATIONS, "");
+
+    for (int i = 0; i < BENCH_ITERATIONS; i += 1) {
+        start = esp_cpu_get_cycle_count();
+        sink = cooling_needed(180, 50, temp.temp[1 + i % 4], temp.temp[2]);
+        sink += heating_needed(180, 50, temp.temp[1 + i % 4], temp.temp[3]);
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    report("cooling_heating_needed", BENCH_ITERATIONS, "");
+
+    // parsing the default profile, and a check that each bad one is rejected
+    struct profile_step_t steps[PROFILE_MAX_STEPS];
+    int rejected = 0;
+    for (int i = 0; i < sizeof(bad_profiles) / sizeof(bad_profiles[0]); i += 1) {
+        rejected += (profile_parse(bad_profiles[i], steps, PROFILE_MAX_STEPS) < 0);
+    }
+    for (int i = 0; i < BENCH_ITERATIONS; i += 1) {
+        start = esp_cpu_get_cycle_count();
+        sink = profile_parse("hold 18.0 4d; ramp 21.0 1d; rest 21.0 2d; ramp 2.0 2d; hold 2.0 3d", steps, PROFILE_MAX_STEPS);
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    snprintf(extra, sizeof(extra), ",\"rejected\":%d,\"bad\":%d",
+             rejected, (int)(sizeof(bad_profiles) / sizeof(bad_profiles[0])));
+    report("profile_parse", BENCH_ITERATIONS, extra);
+
+    // a full redraw: the time spent by the UI, plus the I2C traffic it causes in the display task
+    uint32_t total_writes = 0;
+    for (int i = 0; i < BENCH_REDRAW_ITERATIONS; i += 1) {
+        lcd_clear();
+        display_get_stats(&stats);
+        wait_for_display(stats.i2c_writes);
+
+        display_get_stats(&stats);
+        start = esp_cpu_get_cycle_count();
+        ui_bench_redraw();
+        samples[i] = esp_cpu_get_cycle_count() - start;
+        total_writes += wait_for_display(stats.i2c_writes);
+    }
+    // each PCF8574 write is one transaction of an address byte and a data byte
+    snprintf(extra, sizeof(extra), ",\"i2c_transactions\":%lu,\"i2c_bytes\":%lu",
+             (unsigned long)(total_writes / BENCH_REDRAW_ITERATIONS),
+             (unsigned long)(2 * total_writes / BENCH_REDRAW_ITERATIONS));
+    report("status_display_sensor_temps", BENCH_REDRAW_ITERATIONS, extra);
+
+    for (int i = 0; i < BENCH_NVS_ITERATIONS; i += 1) {
+        start = esp_cpu_get_cycle_count();
+        ui_bench_save();
+        samples[i] = esp_cpu_get_cycle_count() - start;
+    }
+    report("write_sensor_addresses", BENCH_NVS_ITERATIONS, "");
+
+    lowpower_bus_release();
+    puts("{\"bench\":\"done\"}");
+    vTaskDelete(NULL);
+}
+
+#endif // BENCH_ENABLE
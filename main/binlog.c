@@ -0,0 +1,194 @@
+#include <stdarg.h>
+#include <string.h>         // for memcpy(), memset(), strnlen()
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <driver/uart.h>
+#include <esp_timer.h>
+#include "sdkconfig.h"
+
+#include "defines.h"
+#include "binlog.h"
+
+#if BINLOG_ENABLE
+
+// Records go into a byte ring that any task or ISR can write to without taking
+// a lock, and binlog_task() sends them to the console UART as
+//
+//  sync(2) length(1) level(1) fmt(4) time(4) args...
+//
+// where time is esp_timer_get_time() in units of 1024 us (which saves a 64 bit
+// division),
+// and each argument is little-endian: 4 or 8 bytes, or for a string a length
+// byte and the characters. The length counts everything after the sync bytes.
+//
+// Writers reserve space by advancing `head` with a compare-and-swap, fill in
+// the record, and then commit it by storing its length in its first byte. The
+// reader waits for that byte, and zeroes each record once it has been sent, so
+// anything beyond the committed records reads as zero. A record never wraps
+// around the end of the ring: if it doesn't fit, the writer reserves the rest
+// of the ring as padding too.
+//
+// Other binary output on the console UART (the trace, see trace.c) calls
+// binlog_pause() first, so that records aren't spliced into it.
+
+#define BINLOG_PAD          0xff            // marks the rest of the ring as unused
+#define BINLOG_MAX_RECORD   (BINLOG_PAD - 1)
+#define BINLOG_HEADER       10              // length, level, fmt and time
+
+_Static_assert(BINLOG_HEADER + 8 * (1 + BINLOG_MAX_STR) <= BINLOG_MAX_RECORD, "BINLOG_MAX_STR is too long");
+_Static_assert((BINLOG_RING_SIZE & (BINLOG_RING_SIZE - 1)) == 0, "BINLOG_RING_SIZE must be a power of 2");
+
+static const uint8_t sync[] = { 0xfe, 0xb1 };
+
+static uint8_t ring[BINLOG_RING_SIZE];
+static uint32_t head;             // total bytes reserved
+static uint32_t tail;             // total bytes sent (or skipped)
+static uint32_t dropped;          // records lost because the ring was full
+static SemaphoreHandle_t uart_lock;     // held while draining, or while binlog_pause() holds the UART
+static StaticSemaphore_t uart_lock_buf;
+
+
+/// @brief Reserves space in the ring.
+/// @param len the length of the record
+/// @return where to write the record, or NULL if the ring is full
+static uint8_t *reserve(uint32_t len) {
+    uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    uint32_t pad, next;
+
+    do {
+        uint32_t offset = pos % BINLOG_RING_SIZE;
+        pad = (offset + len > BINLOG_RING_SIZE) ? BINLOG_RING_SIZE - offset : 0;
+        next = pos + pad + len;
+        if (next - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) > BINLOG_RING_SIZE) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &pos, next, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (pad != 0) {
+        __atomic_store_n(&ring[pos % BINLOG_RING_SIZE], BINLOG_PAD, __ATOMIC_RELEASE);
+    }
+    return &ring[(pos + pad) % BINLOG_RING_SIZE];
+}
+
+
+/// @brief Records a log message: called by the BINLOG() macros.
+/// @param level the severity
+/// @param fmt the format string (only its address is recorded)
+/// @param types how each argument is passed, 3 bits each (see enum binlog_type_t)
+void binlog_write(enum binlog_level_t level, const char *fmt, uint32_t types, ...) {
+    uint8_t buf[BINLOG_MAX_RECORD];
+    uint32_t addr = (uint32_t)(uintptr_t)fmt;
+    uint32_t time = (uint32_t)(esp_timer_get_time() >> 10);
+    size_t len = BINLOG_HEADER;
+    va_list ap;
+
+    buf[1] = level;
+    memcpy(buf + 2, &addr, 4);
+    memcpy(buf + 6, &time, 4);
+
+    // the ESP32 is little-endian, as is the stream, so values are copied as they are
+    va_start(ap, types);
+    for (; types != 0; types >>= 3) {
+        switch (types & 7) {
+            case BINLOG_T_32: {
+                uint32_t v = va_arg(ap, uint32_t);
+                memcpy(buf + len, &v, 4);
+                len += 4;
+                break;
+            }
+            case BINLOG_T_64: {
+                uint64_t v = va_arg(ap, uint64_t);
+                memcpy(buf + len, &v, 8);
+                len += 8;
+                break;
+            }
+            case BINLOG_T_DOUBLE: {
+                double v = va_arg(ap, double);
+                memcpy(buf + len, &v, 8);
+                len += 8;
+                break;
+            }
+            case BINLOG_T_STR: {
+                const char *s = va_arg(ap, const char *);
+                size_t n = (s == NULL) ? 0 : strnlen(s, BINLOG_MAX_STR);
+                buf[len] = n;
+                memcpy(buf + len + 1, s, n);
+                len += 1 + n;
+                break;
+            }
+        }
+    }
+    va_end(ap);
+
+    uint8_t *p = reserve(len);
+    if (p != NULL) {
+        memcpy(p + 1, buf + 1, len - 1);
+        __atomic_store_n(p, (uint8_t)len, __ATOMIC_RELEASE);     // commit
+    }
+}
+
+
+/// @brief Creates the lock that binlog_pause() takes (call before the tasks start).
+void binlog_init(void) {
+    uart_lock = xSemaphoreCreateMutexStatic(&uart_lock_buf);
+}
+
+
+/// @brief Stops the log going to the console UART, waiting for a drain in progress to finish.
+///
+/// The records are kept in the ring meanwhile (or dropped, if it fills up).
+void binlog_pause(void) {
+    xSemaphoreTake(uart_lock, portMAX_DELAY);
+}
+
+
+/// @brief Lets the log go to the console UART again, after binlog_pause().
+void binlog_resume(void) {
+    xSemaphoreGive(uart_lock);
+}
+
+
+/// @brief Sends the log records to the console UART.
+///
+/// This runs at low priority every BINLOG_DRAIN_MS, so a burst of records goes
+/// out together rather than each one waking a task. The drain itself still wakes
+/// the CPU from light sleep every BINLOG_DRAIN_MS, whether or not there's
+/// anything to send.
+///
+/// @param pParams the parameters passed by xTaskCreate(): not used.
+void binlog_task(void *pParams) {
+    uint32_t reported = 0;
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(BINLOG_DRAIN_MS));
+
+        xSemaphoreTake(uart_lock, portMAX_DELAY);
+        for (;;) {
+            uint32_t offset = tail % BINLOG_RING_SIZE;
+            uint32_t len = __atomic_load_n(&ring[offset], __ATOMIC_ACQUIRE);
+            if (len == 0) {
+                break;                      // nothing else committed yet
+            }
+            if (len == BINLOG_PAD) {
+                len = BINLOG_RING_SIZE - offset;
+            } else {
+                uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, sync, sizeof(sync));
+                uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &ring[offset], len);
+            }
+            memset(&ring[offset], 0, len);
+            __atomic_store_n(&tail, tail + len, __ATOMIC_RELEASE);
+        }
+        xSemaphoreGive(uart_lock);
+
+        // report any lost records, now that there's room for the warning (which goes out next time)
+        uint32_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+        if (lost != reported) {
+            BINLOG_W("log: %lu records dropped", (unsigned long)(lost - reported));
+            reported = lost;
+        }
+    }
+}
+
+#endif // BINLOG_ENABLE
@@ -0,0 +1,74 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "defines.h"
+
+// Deferred-format logging. A log call stores the address of its format string
+// and the raw values of its arguments, and tools/logdecode.py does the
+// formatting on the host, using the strings from the ELF file. The strings are
+// kept in the .binlog section, which isn't loaded onto the device.
+//
+// Up to 8 arguments are supported. Integers and pointers up to 32 bits, 64 bit
+// integers, floats/doubles and strings (truncated to BINLOG_MAX_STR) are recorded;
+// the format string must describe them as printf() would. With BINLOG_ENABLE
+// set to 0 the calls fall back to printf().
+
+enum binlog_level_t {
+    BINLOG_ERROR,
+    BINLOG_WARN,
+    BINLOG_INFO
+};
+
+#if BINLOG_ENABLE
+
+enum binlog_type_t {                        // how each argument is recorded, 3 bits each
+    BINLOG_T_NONE,
+    BINLOG_T_32,
+    BINLOG_T_64,
+    BINLOG_T_DOUBLE,
+    BINLOG_T_STR
+};
+
+struct binlog_none_t { char unused; };
+#define BINLOG_NONE         ((struct binlog_none_t){ 0 })
+
+#define BINLOG_TYPE(x) _Generic((x),                \
+    struct binlog_none_t: BINLOG_T_NONE,            \
+    float: BINLOG_T_DOUBLE,                         \
+    double: BINLOG_T_DOUBLE,                        \
+    long long: BINLOG_T_64,                         \
+    unsigned long long: BINLOG_T_64,                \
+    char *: BINLOG_T_STR,                           \
+    const char *: BINLOG_T_STR,                     \
+    default: BINLOG_T_32)
+
+#define BINLOG_TYPES_(_, a, b, c, d, e, f, g, h, ...)                                   \
+    (BINLOG_TYPE(a)       | BINLOG_TYPE(b) << 3  | BINLOG_TYPE(c) << 6  | BINLOG_TYPE(d) << 9 | \
+     BINLOG_TYPE(e) << 12 | BINLOG_TYPE(f) << 15 | BINLOG_TYPE(g) << 18 | BINLOG_TYPE(h) << 21)
+#define BINLOG_TYPES(...)   BINLOG_TYPES_(0, ##__VA_ARGS__, BINLOG_NONE, BINLOG_NONE, BINLOG_NONE, \
+                                          BINLOG_NONE, BINLOG_NONE, BINLOG_NONE, BINLOG_NONE, BINLOG_NONE)
+
+#define BINLOG(level, fmt, ...) do {                                                    \
+        static const char binlog_fmt[] __attribute__((section(".binlog"), used)) = fmt; \
+        binlog_write(level, binlog_fmt, BINLOG_TYPES(__VA_ARGS__), ##__VA_ARGS__);      \
+    } while (0)
+
+void binlog_write(enum binlog_level_t level, const char *fmt, uint32_t types, ...);
+void binlog_init(void);
+void binlog_pause(void);
+void binlog_resume(void);
+void binlog_task(void *pParams);
+
+#else
+
+#define BINLOG(level, fmt, ...)     printf(fmt "\n", ##__VA_ARGS__)
+
+#endif // BINLOG_ENABLE
+
+#define BINLOG_E(fmt, ...)  BINLOG(BINLOG_ERROR, fmt, ##__VA_ARGS__)
+#define BINLOG_W(fmt, ...)  BINLOG(BINLOG_WARN, fmt, ##__VA_ARGS__)
+#define BINLOG_I(fmt, ...)  BINLOG(BINLOG_INFO, fmt, ##__VA_ARGS__)
+
+#endif // BINLOG_H
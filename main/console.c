@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+#include "sdkconfig.h"
+#include "esp_sleep.h"
+
+#include "defines.h"
+#include "lcd.h"
+#include "lowpower.h"
+#include "metrics.h"
+#include "trace.h"
+#include "layout.h"
+#include "profile.h"
+#include "console.h"
+
+
+static void help(void) {
+    puts("\nl: LCD contents\nm: metrics\np: power management\nc: next task layout (restarts)\n"
+         "1, 2: start or stop fridge 1 or 2's profile\nh: help");
+#if TRACE_ENABLE
+    puts("t: binary trace (for tools/trace2json.py)");
+#endif
+}
+
+
+/// @brief Starts a fridge's profile from the first step, or stops it if it's running.
+/// @param fridge_num the fridge
+static void toggle_profile(int fridge_num) {
+    struct profile_status_t p;
+
+    profile_get_status(fridge_num, 0, &p);
+    if (p.state == PROFILE_RUNNING) {
+        profile_stop(fridge_num);
+        printf("fridge %d: profile stopped\n", fridge_num + 1);
+    } else if (profile_start(fridge_num)) {
+        printf("fridge %d: profile started (%d steps)\n", fridge_num + 1, p.num_steps);
+    } else {
+        printf("fridge %d: no profile\n", fridge_num + 1);
+    }
+}
+
+
+/// @brief Installs the UART driver for the console, which the binary outputs also use.
+///
+/// Light sleep stops the UART, so the first character typed only wakes the CPU
+/// and may be lost.
+void console_init(void) {
+    ESP_ERROR_CHECK(uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, CONSOLE_RX_BUF_SIZE, 0, 0, NULL, 0));
+    uart_set_wakeup_threshold(CONFIG_ESP_CONSOLE_UART_NUM, 3);      // (the minimum number of edges)
+    esp_sleep_enable_uart_wakeup(CONFIG_ESP_CONSOLE_UART_NUM);
+}
+
+
+/// @brief Prints diagnostics on request, one key per report.
+/// @param pParams the parameters passed by xTaskCreate(): not used.
+void console_task(void *pParams) {
+    char c;
+
+    for (;;) {
+        if (uart_read_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &c, 1, portMAX_DELAY) != 1) {
+            continue;
+        }
+
+        switch (c) {
+            case 'l':
+                lcd_dump();
+                break;
+
+            case 'm':
+                metrics_dump();
+                break;
+
+            case 'p':
+                lowpower_report();
+                break;
+
+            case 'c':
+                layout_next();
+                break;
+
+            case '1':
+            case '2':
+                toggle_profile(c - '1');
+                break;
+
+#if TRACE_ENABLE
+            case 't':
+                trace_stream();
+                break;
+#endif
+
+            case 'h':
+            case '?':
+                help();
+                break;
+
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,7 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+void console_init(void);
+void console_task(void *pParams);
+
+#endif // CONSOLE_H
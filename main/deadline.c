@@ -0,0 +1,114 @@
+#include <freertos/FreeRTOS.h>
+#include <stdbool.h>
+
+#include "defines.h"
+#include "deadline.h"
+
+// binary min-heap of timer ids, ordered by expiry time
+static int heap[MAX_DEADLINES];
+static int heap_size = 0;
+static int heap_pos[MAX_DEADLINES];         // position of each timer in the heap (+1, so 0 means not set)
+static TickType_t expiry_time[MAX_DEADLINES];
+
+
+/// @brief Compares two tick counts, allowing for wraparound.
+/// @return true if `a` is earlier than `b`
+static bool earlier(TickType_t a, TickType_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+
+/// @brief Places a timer at a position in the heap.
+static void place(int pos, int id) {
+    heap[pos] = id;
+    heap_pos[id] = pos + 1;
+}
+
+
+/// @brief Moves the timer at a position up the heap until it's later than its parent.
+static void sift_up(int pos) {
+    int id = heap[pos];
+    while (pos > 0 && earlier(expiry_time[id], expiry_time[heap[(pos - 1) / 2]])) {
+        place(pos, heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    place(pos, id);
+}
+
+
+/// @brief Moves the timer at a position down the heap until it's earlier than its children.
+static void sift_down(int pos) {
+    int id = heap[pos];
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size && earlier(expiry_time[heap[child + 1]], expiry_time[heap[child]])) {
+            child += 1;
+        }
+        if (!earlier(expiry_time[heap[child]], expiry_time[id])) {
+            break;
+        }
+        place(pos, heap[child]);
+        pos = child;
+    }
+    place(pos, id);
+}
+
+
+/// @brief Starts (or restarts) a one-shot timer.
+/// @param id the timer, from 0 to MAX_DEADLINES - 1
+/// @param expiry the tick count at which the timer expires
+void deadline_set(int id, TickType_t expiry) {
+    expiry_time[id] = expiry;
+    if (heap_pos[id] == 0) {
+        heap_size += 1;
+        place(heap_size - 1, id);
+    }
+    sift_up(heap_pos[id] - 1);
+    sift_down(heap_pos[id] - 1);
+}
+
+
+/// @brief Stops a timer (if it's running).
+/// @param id the timer
+void deadline_cancel(int id) {
+    int pos = heap_pos[id] - 1;
+    if (pos < 0) {
+        return;
+    }
+    heap_pos[id] = 0;
+    heap_size -= 1;
+    if (pos < heap_size) {
+        int last = heap[heap_size];     // fill the gap with the last timer
+        place(pos, last);
+        sift_up(pos);
+        sift_down(heap_pos[last] - 1);
+    }
+}
+
+
+/// @brief Calculates how long to wait for the next timer to expire.
+/// @param now the current tick count
+/// @return the number of ticks to wait, or portMAX_DELAY if no timers are running
+TickType_t deadline_wait_time(TickType_t now) {
+    if (heap_size == 0) {
+        return portMAX_DELAY;
+    }
+    TickType_t next = expiry_time[heap[0]];
+    return earlier(now, next) ? next - now : 0;
+}
+
+
+/// @brief Removes the earliest timer from the heap if it has expired.
+/// @param now the current tick count
+/// @return the expired timer, or DEADLINE_NONE if no timers have expired
+int deadline_pop_expired(TickType_t now) {
+    if (heap_size == 0 || earlier(now, expiry_time[heap[0]])) {
+        return DEADLINE_NONE;
+    }
+    int id = heap[0];
+    deadline_cancel(id);
+    return id;
+}
@@ -0,0 +1,13 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <freertos/FreeRTOS.h>
+
+#define DEADLINE_NONE   -1
+
+void deadline_set(int id, TickType_t expiry);
+void deadline_cancel(int id);
+TickType_t deadline_wait_time(TickType_t now);
+int deadline_pop_expired(TickType_t now);
+
+#endif // DEADLINE_H
@@ -4,12 +4,35 @@
 
 #define ONEWIRE_GPIO            17
 #define MAX_TEMP_SENSORS        12      // LCD can show three rows of four
+#define MAX_SENSOR_FIELDS       6       // beer, air and heat for each fridge
+
+#define SENSOR_POLL_ALL         0       // scan the bus and read every sensor on every cycle
+#define SENSOR_POLL_ALARM       1       // only read sensors that have left their TL/TH alarm window
+#define SENSOR_POLL_ROLE        2       // read each sensor at a rate set by its field and the power state
+#define SENSOR_POLL_MODE        SENSOR_POLL_ROLE
+#define SENSOR_FULL_READ_CYCLES 30      // alarm/role modes: rescan and read every sensor every n cycles
+#define SENSOR_ACTIVE_CYCLES    1       // role mode: air/heat sensor of a fridge that's cooling/heating
+#define SENSOR_IDLE_CYCLES      5       // role mode: other air/heat sensors
+#define SENSOR_BEER_CYCLES      10      // role mode: beer sensors
+#define SENSOR_ALARM_MARGIN     1       // alarm mode: window half-width in whole degrees C
+#define SENSOR_FAST_READ        1       // read just the two temperature bytes of the scratchpad
+#define SENSOR_CRC_CHECK_CYCLES 10      // fast read: do a full CRC-checked read of each sensor every n reads
+#define SENSOR_PLAUSIBLE_JUMP   2.0     // fast read: verify any change bigger than this (degrees C)
 
 // LCD display
 //
 #define SDA_GPIO                16
 #define SCL_GPIO                4
 #define I2C_ADDR                0x27
+#define DISPLAY_QUEUE_SIZE      32      // pending screen changes before the display task redraws everything
+#define DISPLAY_BUDGET_US       5000    // maximum time spent writing to the LCD before checking for newer changes
+#define DISPLAY_CLK_START_HZ    100000  // PCF8574 rated speed
+#define DISPLAY_CLK_MIN_HZ      25000   // halve the I2C clock on each write error down to this..
+#define DISPLAY_CLK_MAX_HZ      400000  // ..and double it after a clean period up to this
+#define DISPLAY_CLEAN_MS        (10 * 60 * 1000)        // clean period before raising the clock
+#define DISPLAY_CLEAN_MAX_MS    (8 * 60 * 60 * 1000)    // the clean period doubles each time a raised clock fails
+#define DISPLAY_RETRY_MS        100     // delay between attempts to re-initialise the LCD
+#define DISPLAY_REFRESH_MS      (60 * 1000)             // redraw the LCD this often regardless, while the backlight is on
 
 // rotary encoder
 //
@@ -17,6 +40,14 @@
 #define RE_B_GPIO               25
 #define RE_BTN_GPIO             27
 #define RE_EVENT_QUEUE_SIZE     10
+#define RE_USE_PCNT             1       // use the PCNT/interrupt backend instead of esp-idf-lib's polling one
+#define RE_PCNT_COUNTS_PER_DETENT 4     // PCNT backend: quadrature edges per detent
+#define RE_PCNT_GLITCH_NS       10000   // PCNT backend: ignore pulses shorter than this (max 12.7 us)
+#define RE_BTN_PRESSED_LEVEL    0
+#define RE_BTN_DEBOUNCE_US      10000
+#define RE_BTN_LONG_PRESS_US    500000
+#define RE_ACCEL_MIN_RATE       5       // detents per second before settings start to accelerate
+#define RE_ACCEL_MAX            10      // maximum multiplier for fast turns
 
 // UI
 //
@@ -24,6 +55,62 @@
 #define UI_BLINKS_PER_FLASH     4
 #define UI_BLINKS_PER_TIMEOUT   30
 #define UI_BLINKS_PER_SLEEP     400
+#define UI_GRAPH_MIN_SPAN       8       // trend graph: smallest temperature range it's scaled to, in tenths
+#define CONTROL_PERIOD_MS       1000    // power state update interval, besides on new sensor data
+#define MAX_DEADLINES           8       // number of timers in the deadline scheduler
+#define CONSOLE_RX_BUF_SIZE     256     // diagnostics console on the serial port
+#define METRICS_MAX_TASKS       8       // tasks in the stack high-water mark report
+#define STACK_MARGIN            512     // spare stack on top of the high-water mark, in bytes
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE            0       // set by the top level CMakeLists.txt, which also adds the kernel hooks
+#endif
+#define TRACE_RING_SIZE         1024    // trace records of 8 bytes each (max 65535)
+#define TRACE_MAX_TASKS         16
+#define BINLOG_ENABLE           1       // deferred-format logging (0 for plain printf)
+#define BINLOG_RING_SIZE        2048    // bytes, must be a power of 2
+#define BINLOG_MAX_STR          24      // longest string argument recorded
+#define BINLOG_DRAIN_MS         1000    // how often the log is sent to the console
+
+
+// temperature history
+//
+#define HISTORY_5M_BUCKETS      48      // 4 hours of 5 minute data points for each sensor field
+#define HISTORY_1H_BUCKETS      168     // 7 days of hourly data points for each sensor field
+#define HISTORY_MAX_GAP_MS      (60 * 1000)     // longest time between readings counted as above/below the set point
+
+
+// task stacks in bytes: after a long run on the device, set each one to the
+// "needs" figure in the console's metrics report (its high-water mark plus
+// STACK_MARGIN). None has been measured yet, so they stay at the sizes they had
+// before they were made static, except HTTP's, whose estimate came close to its
+// old 4 KB. The comments give the deepest call chain as estimated from the code
+//
+#define DISPLAY_TASK_STACK      3072    // ~1.4 KB: a resync's log call, as printf with BINLOG_ENABLE 0
+#define UI_TASK_STACK           3072    // ~2.0 KB: snprintf() when drawing the graph
+#define SENSOR_TASK_STACK       3072    // ~1.4 KB: a log call, as printf with BINLOG_ENABLE 0
+#define CONSOLE_TASK_STACK      3072    // ~1.4 KB: printf() in the reports
+#define BINLOG_TASK_STACK       3072    // ~0.6 KB: its own warning about dropped records
+#define BENCH_TASK_STACK        3072    // ~1.5 KB: snprintf() in the status screen redraw
+#define MQTT_TASK_STACK         4096    // ~1.6 KB: esp_mqtt_client_publish() and the TCP send
+#define HTTP_TASK_STACK         4352    // ~3.1 KB: httpd, a handler's chunk buffer and the TCP send
+
+
+// telemetry
+//
+#define TELEMETRY_UART          1
+#define TELEMETRY_TX_GPIO       23
+#define TELEMETRY_BAUD          115200
+#define TELEMETRY_TX_BUF_SIZE   1024    // messages are dropped rather than wait for room here
+#define TELEMETRY_METRICS_MS    (60 * 1000)
+
+
+// power management
+//
+#define PM_MAX_CPU_FREQ_MHZ     240
+#define PM_MIN_CPU_FREQ_MHZ     40      // XTAL frequency
+#define PM_IDLE_UA              1500    // estimated baseline current in automatic light sleep
+#define PM_BACKLIGHT_UA         20000   // estimated extra current with the LCD backlight on
+#define PM_WAKEUP_UC            30      // estimated charge used by each task wakeup (about 1 ms at 30 mA)
 
 
 // power control
@@ -32,9 +119,78 @@
 #define F2_RELAY_GPIO           33
 #define F1_SSR_GPIO             18
 #define F2_SSR_GPIO             19
+#define F1_COMPRESSOR_W         120     // for the energy estimates
+#define F2_COMPRESSOR_W         120
+#define F1_HEATER_W             60
+#define F2_HEATER_W             60
+#define ENERGY_BUCKETS          24      // per rolling window, so 2.5 min resolution over 1 hour
 
 
 // power control timeouts in ms
 #define MIN_OFF_TIME            (2 * 60 * 1000) / portTICK_PERIOD_MS        // 2 mins recovery time after heating/cooling
 #define MIN_COOLING_TIME        (30 * 1000)  / portTICK_PERIOD_MS           // keep fridge on for at least 30 sec
 #define MAX_COOLING_TIME        (60 * 60 * 1000)  / portTICK_PERIOD_MS      // run fridge for max 1hr at a time
+#define LOAD_MIN_START_GAP      (10 * 1000)  / portTICK_PERIOD_MS           // at least 10 sec between any two compressor/heater starts
+
+
+// control loop deadlines in ms
+#define FAILSAFE_CHECK_MS       1000
+#define FAILSAFE_CONTROL_SOFT_MS (2 * CONTROL_PERIOD_MS)        // count a late control pass..
+#define FAILSAFE_CONTROL_HARD_MS (30 * 1000)                    // ..and switch everything off after this
+#define FAILSAFE_SENSOR_SOFT_MS (5 * 1000)                      // count late readings..
+#define FAILSAFE_SENSOR_HARD_MS (60 * 1000)                     // ..and switch everything off after this
+
+
+// WiFi, for the MQTT publisher and the HTTP server
+//
+#define WIFI_SSID               "brewery"
+#define WIFI_PASSWORD           ""
+
+
+// MQTT publisher (see mqtt.c)
+//
+#define MQTT_ENABLE             0       // also publish the telemetry stream to a broker over WiFi
+#define MQTT_BROKER_URI         "mqtt://192.168.1.10"
+#define MQTT_TOPIC              "brewfridge/telemetry"
+#define MQTT_BATCH_MS           (10 * 1000)     // how often the waiting frames are published
+#define MQTT_MAX_BATCH          1024    // largest message, in bytes
+#define MQTT_BUFFER_SIZE        4096    // frames waiting to be published, in bytes (a power of 2)
+
+
+// HTTP server (see http.c)
+//
+#define HTTP_ENABLE             0       // serve the state and the history over WiFi
+#define HTTP_PORT               80
+#define HTTP_MAX_CONNECTIONS    4       // open at once, the oldest is closed to make room for another
+#define HTTP_CHUNK_SIZE         512     // bytes sent at a time, the only buffer a response needs
+#define HTTP_TASK_PRIORITY      2       // below the sensor and UI tasks
+#define HTTP_PROFILE_WRITE      0       // accept POST /profile (unauthenticated: anyone on the network can change a profile)
+
+
+// fermentation profiles (see profile.c)
+//
+#define PROFILE_MAX_STEPS       32      // per fridge, 4 bytes each in NVS
+#define PROFILE_SAVE_MS         (10 * 60 * 1000)        // how often a running profile's progress is saved
+#define PROFILE_MIN_TEMP        0       // the range a step's temperature can be set to, in 1/10 C
+#define PROFILE_MAX_TEMP        400
+
+
+// task layout (see layout.c)
+//
+#define TASK_LAYOUT             1       // until the console picks another: 0 shared, 1 split, 2 swapped
+
+
+// load scheduler
+//
+#define LOAD_MAX_COMPRESSORS    2       // compressors allowed on at once (1 halves the peak, but a fridge may wait up to MAX_COOLING_TIME)
+#define LOAD_MAX_HEATERS        2       // heaters allowed on at once
+
+
+// benchmarks
+//
+#define BENCH_ENABLE            0       // run the benchmarks in bench.c instead of the UI and sensor tasks
+#define BENCH_ITERATIONS        256
+#define BENCH_REDRAW_ITERATIONS 8       // each one waits for the display task to finish drawing
+#define BENCH_NVS_ITERATIONS    8       // each one writes to flash
+#define JITTER_ENABLE           0       // run the jitter probes in jitter.c alongside the UI and sensor tasks
+#define JITTER_ENCODER_US       1000    // esp-idf-lib's encoder sampling interval (CONFIG_RE_INTERVAL_US)
@@ -0,0 +1,419 @@
+#include <string.h>         // for memset()
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>      // for esp_timer_get_time()
+#include <hd44780.h>
+#include <pcf8574.h>
+
+#include "defines.h"
+#include "lcd.h"
+#include "display_task.h"
+#include "metrics.h"
+#include "trace.h"
+#include "binlog.h"
+
+#define ALL_COLUMNS     ((1u << LCD_COLS) - 1)
+#define NUM_GLYPH_ROWS  (LCD_GLYPHS * LCD_GLYPH_ROWS)
+#define CMD_CGRAM_ADDR  0x40        // HD44780 Set CGRAM Address command
+#define UNKNOWN_CHAR    '\xff'      // what we think a character is when we don't know (the UI never draws it)
+
+QueueHandle_t display_queue;
+volatile bool display_overflow;     // set by the UI if it couldn't post a change
+
+static i2c_dev_t pcf8574;   // see https://esp-idf-lib.readthedocs.io/en/latest/groups/i2cdev.html
+
+static char frame[LCD_ROWS * LCD_COLS];     // what the UI wants on the screen
+static char shown[LCD_ROWS * LCD_COLS];     // what we think is on the screen
+static uint32_t dirty[LCD_ROWS];            // one bit per column that may need redrawing
+static uint8_t glyphs[NUM_GLYPH_ROWS];      // what the UI wants in CGRAM
+static uint8_t shown_glyphs[NUM_GLYPH_ROWS];        // what we think is in CGRAM
+static uint64_t glyph_dirty;                // one bit per glyph row that may need uploading
+static uint8_t glyphs_used;                 // one bit per glyph the UI has defined
+static int cursor_row = -1;                 // where the next character will go, if known
+static int cursor_col = -1;
+
+static struct display_stats_t stats = { .clk_speed = DISPLAY_CLK_START_HZ };
+static volatile bool bus_error;             // set if a write to the PCF8574 failed
+static bool clock_raised;                   // the clock has been raised since the last error
+static uint32_t clean_ms = DISPLAY_CLEAN_MS;
+static TickType_t last_clock_change;
+static TickType_t last_refresh;
+static bool backlight = true;               // there's no point refreshing a screen nobody can see
+
+
+static esp_err_t write_lcd_data(const hd44780_t *lcd, uint8_t data) {
+    esp_err_t err = pcf8574_port_write(&pcf8574, data);
+    stats.i2c_writes += 1;
+    TRACE(TRACE_I2C_WRITE, data, err);
+    if (err != ESP_OK) {
+        stats.i2c_errors += 1;
+        bus_error = true;
+    }
+    return err;
+}
+
+static hd44780_t lcd = {
+        .write_cb = write_lcd_data, // use callback to send data to LCD via I2C GPIO expander
+        .font = HD44780_FONT_5X8,
+        .lines = LCD_ROWS,
+        .pins = {
+            .rs = 0,
+            .e  = 2,
+            .d4 = 4,
+            .d5 = 5,
+            .d6 = 6,
+            .d7 = 7,
+            .bl = 3
+        }
+    };
+
+
+/// @brief Marks every character on the screen as needing to be redrawn.
+static void mark_all(void) {
+    for (int row = 0; row < LCD_ROWS; row += 1) {
+        dirty[row] = ALL_COLUMNS;
+    }
+}
+
+
+/// @brief Marks a run of characters as needing to be redrawn.
+/// @param row the row
+/// @param col the first column
+/// @param len the number of characters
+static void mark_dirty(int row, int col, int len) {
+    if (row < 0 || row >= LCD_ROWS || col < 0 || col >= LCD_COLS || len <= 0) {
+        return;
+    }
+    if (len > LCD_COLS - col) {
+        len = LCD_COLS - col;
+    }
+    dirty[row] |= (ALL_COLUMNS >> (LCD_COLS - len)) << col;
+}
+
+
+/// @brief Marks a run of glyph rows as needing to be uploaded.
+/// @param num the glyph
+/// @param first the first pixel row
+/// @param len the number of rows
+static void mark_glyph_dirty(int num, int first, int len) {
+    if (num < 0 || num >= LCD_GLYPHS || first < 0 || first >= LCD_GLYPH_ROWS || len <= 0) {
+        return;
+    }
+    if (len > LCD_GLYPH_ROWS - first) {
+        len = LCD_GLYPH_ROWS - first;
+    }
+    glyphs_used |= 1u << num;
+    glyph_dirty |= ((1ull << len) - 1) << (num * LCD_GLYPH_ROWS + first);
+}
+
+
+/// @brief Re-initialises the LCD controller, after which nothing is known about the screen.
+///
+/// The glyphs the UI has defined are uploaded again too, in case whatever garbled
+/// the screen garbled them as well.
+static void reset(void) {
+    hd44780_init(&lcd);
+    memset(shown, ' ', sizeof(shown));
+    memset(shown_glyphs, 0xff, sizeof(shown_glyphs));   // never a valid row, so all are sent
+    cursor_row = -1;
+    mark_all();
+    for (int num = 0; num < LCD_GLYPHS; num += 1) {
+        if (glyphs_used & (1u << num)) {
+            mark_glyph_dirty(num, 0, LCD_GLYPH_ROWS);
+        }
+    }
+    last_refresh = xTaskGetTickCount();
+}
+
+
+/// @brief Redraws every character, in case noise garbled the screen without a write failing.
+///
+/// Unlike reset() this doesn't re-initialise the controller (which blanks the
+/// screen) or upload the glyphs again, so it doesn't flicker, and costs one
+/// cursor move and a write per character.
+static void refresh(void) {
+    memset(shown, UNKNOWN_CHAR, sizeof(shown));
+    cursor_row = -1;
+    mark_all();
+    last_refresh = xTaskGetTickCount();
+}
+
+
+/// @brief Changes the I2C clock, which takes effect on the next transfer.
+/// @param hz the new clock speed
+static void set_clock(uint32_t hz) {
+    stats.clk_speed = hz;
+    pcf8574.cfg.master.clk_speed = hz;
+    last_clock_change = xTaskGetTickCount();
+}
+
+
+/// @brief Slows down the bus and redraws the screen after a failed write.
+///
+/// A failed write means the LCD may have seen half a command, or a nibble of one,
+/// so we can't trust anything on it until the controller has been re-initialised.
+static void resync(void) {
+    while (bus_error) {
+        bus_error = false;
+
+        // if a faster clock didn't work out, wait longer before trying it again
+        if (clock_raised && clean_ms < DISPLAY_CLEAN_MAX_MS) {
+            clean_ms *= 2;
+        }
+        clock_raised = false;
+        if (stats.clk_speed / 2 >= DISPLAY_CLK_MIN_HZ) {
+            set_clock(stats.clk_speed / 2);
+        } else {
+            last_clock_change = xTaskGetTickCount();
+        }
+        BINLOG_W("LCD write failed: resyncing at %lu Hz", (unsigned long)stats.clk_speed);
+
+        stats.resyncs += 1;
+        reset();
+        if (bus_error) {
+            vTaskDelay(pdMS_TO_TICKS(DISPLAY_RETRY_MS));
+        }
+    }
+}
+
+
+/// @brief Raises the I2C clock after a long enough period without errors.
+/// @param now the current tick count
+static void speed_up(TickType_t now) {
+    if (stats.clk_speed * 2 <= DISPLAY_CLK_MAX_HZ
+        && now - last_clock_change >= pdMS_TO_TICKS(clean_ms)) {
+        set_clock(stats.clk_speed * 2);
+        clock_raised = true;
+    }
+}
+
+
+/// @brief Reports the health of the LCD bus.
+/// @param pStats where to store the counters
+void display_get_stats(struct display_stats_t *pStats) {
+    *pStats = stats;
+}
+
+
+/// @brief Acts on a message from the UI.
+/// @param msg the message
+static void handle_msg(const struct display_msg_t *msg) {
+    switch (msg->type) {
+        case DISPLAY_MSG_REGION:
+            mark_dirty(msg->row, msg->col, msg->len);
+            break;
+
+        case DISPLAY_MSG_GLYPH:
+            mark_glyph_dirty(msg->row, msg->col, msg->len);
+            break;
+
+        case DISPLAY_MSG_FRAME:
+            mark_all();
+            break;
+
+        case DISPLAY_MSG_BACKLIGHT:
+            backlight = (msg->len != 0);
+            hd44780_switch_backlight(&lcd, backlight);
+            break;
+
+        case DISPLAY_MSG_RESET:
+            reset();
+            break;
+    }
+}
+
+
+/// @brief Writes the characters in part of a row that are dirty and have changed.
+///
+/// Runs of adjacent characters are written after a single cursor move, since the
+/// controller advances the cursor by itself.
+///
+/// @param row the row
+/// @param first the first column to consider
+/// @param last the last column to consider
+/// @param deadline the esp_timer time at which to give up
+/// @return true if the part of the row is up to date, false if we ran out of time
+static bool render(int row, int first, int last, int64_t deadline) {
+    int col = first;
+
+    while (col <= last) {
+        int i = row * LCD_COLS + col;
+        if (!(dirty[row] & (1u << col)) || frame[i] == shown[i]) {
+            dirty[row] &= ~(1u << col);
+            col += 1;
+            continue;
+        }
+
+        if (cursor_row != row || cursor_col != col) {
+            hd44780_gotoxy(&lcd, col, row);
+        }
+        while (col <= last && (dirty[row] & (1u << col)) && frame[i] != shown[i]) {
+            hd44780_putc(&lcd, frame[i]);
+            shown[i] = frame[i];
+            dirty[row] &= ~(1u << col);
+            col += 1;
+            i += 1;
+        }
+        cursor_row = row;
+        cursor_col = col;
+
+        if (bus_error || esp_timer_get_time() > deadline) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/// @brief Points the controller at a row of CGRAM, so that the data that follows defines glyphs.
+///
+/// esp-idf-lib's driver can only upload whole glyphs, so this sends the command
+/// itself, as two nibbles strobed through the PCF8574 the way the driver does.
+/// The command takes 37 us, less than the next I2C transfer.
+///
+/// @param addr the CGRAM address, glyph * LCD_GLYPH_ROWS + pixel row
+static void set_cgram_address(int addr) {
+    uint8_t cmd = CMD_CGRAM_ADDR | (addr & 0x3f);
+
+    for (int shift = 4; shift >= 0; shift -= 4) {
+        uint8_t nibble = cmd >> shift;
+        uint8_t data = (((nibble >> 3) & 1) << lcd.pins.d7)
+                     | (((nibble >> 2) & 1) << lcd.pins.d6)
+                     | (((nibble >> 1) & 1) << lcd.pins.d5)
+                     | ((nibble & 1) << lcd.pins.d4)
+                     | (lcd.backlight ? 1 << lcd.pins.bl : 0);      // and RS low for a command
+        write_lcd_data(&lcd, data | (1 << lcd.pins.e));
+        write_lcd_data(&lcd, data);
+    }
+}
+
+
+/// @brief Uploads the glyph rows that are dirty and have changed.
+///
+/// Like the cursor, the CGRAM address advances by itself, so a run of adjacent
+/// rows (even across glyphs) is written after a single address command. After
+/// that the cursor position is unknown, and the next character needs a move.
+///
+/// @param deadline the esp_timer time at which to give up
+/// @return true if CGRAM is up to date, false if we ran out of time
+static bool render_glyphs(int64_t deadline) {
+    int i = 0;
+
+    while (i < NUM_GLYPH_ROWS) {
+        if (!(glyph_dirty & (1ull << i)) || glyphs[i] == shown_glyphs[i]) {
+            glyph_dirty &= ~(1ull << i);
+            i += 1;
+            continue;
+        }
+
+        set_cgram_address(i);
+        while (i < NUM_GLYPH_ROWS && (glyph_dirty & (1ull << i)) && glyphs[i] != shown_glyphs[i]) {
+            hd44780_putc(&lcd, glyphs[i]);
+            shown_glyphs[i] = glyphs[i];
+            glyph_dirty &= ~(1ull << i);
+            i += 1;
+        }
+        cursor_row = -1;
+
+        if (bus_error || esp_timer_get_time() > deadline) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/// @brief Owns the LCD and copies the UI's shadow of the screen to it.
+///
+/// The UI posts a message for each change, and the task redraws the characters that
+/// differ from what it last sent, then uploads any changed rows of the user-defined
+/// characters. The field being edited (hidden by `lcd_hide()`) is redrawn first,
+/// and each pass stops after DISPLAY_BUDGET_US so that it can pick up newer
+/// changes instead of drawing ones that are already out of date.
+///
+/// @param pParams the parameters passed by xTaskCreate(): not used.
+void display_task(void *pParams) {
+    struct display_msg_t msg;
+    int focus_row, focus_col, focus_len;
+
+    ESP_ERROR_CHECK(i2cdev_init());                     // initialise the I2C library
+    memset(&pcf8574, 0, sizeof(i2c_dev_t));
+    ESP_ERROR_CHECK(pcf8574_init_desc(&pcf8574,         // struct i2c_dev_t*
+                                      I2C_ADDR,         // from define.h
+                                      0,                // i2c_port_t
+                                      SDA_GPIO,         // .. .. ..
+                                      SCL_GPIO));       // .. .. ..
+
+    // start at a clock the PCF8574 is specified for, and let resync() and speed_up()
+    // find the fastest one that works reliably
+    set_clock(DISPLAY_CLK_START_HZ);
+
+    reset();
+    hd44780_switch_backlight(&lcd, true);
+    resync();
+
+    for (;;) {
+        bool pending = (glyph_dirty != 0);
+        for (int row = 0; row < LCD_ROWS; row += 1) {
+            pending |= (dirty[row] != 0);
+        }
+
+        // wait for a change if the screen is up to date, otherwise just collect any new ones
+        // (with the backlight off, there's no refresh to wake up for either)
+        //
+        TickType_t wait = 0;
+        TickType_t since_refresh = xTaskGetTickCount() - last_refresh;
+        if (!pending && !backlight) {
+            wait = portMAX_DELAY;
+        } else if (!pending && since_refresh < pdMS_TO_TICKS(DISPLAY_REFRESH_MS)) {
+            wait = pdMS_TO_TICKS(DISPLAY_REFRESH_MS) - since_refresh;
+        }
+        if (xQueueReceive(display_queue, &msg, wait) == pdTRUE) {
+            do {
+                handle_msg(&msg);
+            } while (xQueueReceive(display_queue, &msg, 0) == pdTRUE);
+        }
+        if (display_overflow) {
+            display_overflow = false;
+            mark_all();
+            glyph_dirty = ~0ull;            // only the rows that differ are sent
+        }
+
+        // noise can garble the LCD without the I2C transfer failing, so every so often
+        // redraw everything anyway (the controller is only re-initialised after a failed write)
+        //
+        TickType_t now = xTaskGetTickCount();
+        if (backlight && now - last_refresh >= pdMS_TO_TICKS(DISPLAY_REFRESH_MS)) {
+            refresh();
+        }
+        speed_up(now);
+
+        // redraw the field being edited first, then everything else
+        //
+        lcd_get_frame(frame, &focus_row, &focus_col, &focus_len);
+        uint32_t writes = stats.i2c_writes;
+        int64_t start = esp_timer_get_time();
+        int64_t deadline = start + DISPLAY_BUDGET_US;
+        bool done = true;
+        if (focus_len > 0) {
+            done = render(focus_row, focus_col, focus_col + focus_len - 1, deadline);
+        }
+        for (int row = 0; done && row < LCD_ROWS; row += 1) {
+            done = render(row, 0, LCD_COLS - 1, deadline);
+        }
+        if (done && glyph_dirty != 0) {
+            lcd_get_glyphs(glyphs);
+            done = render_glyphs(deadline);
+        }
+        if (stats.i2c_writes != writes) {
+            metrics_record(METRIC_LCD_FLUSH, esp_timer_get_time() - start);
+        }
+
+        if (bus_error) {
+            resync();
+        } else if (!done) {
+            vTaskDelay(1);      // let the lower priority tasks run before carrying on
+        }
+    }
+}
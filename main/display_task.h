@@ -0,0 +1,37 @@
+#ifndef DISPLAY_TASK_H
+#define DISPLAY_TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+enum display_msg_type_t {
+    DISPLAY_MSG_REGION,     // some characters of one row have changed
+    DISPLAY_MSG_GLYPH,      // some pixel rows (col, len) of a user-defined character (row) have changed
+    DISPLAY_MSG_FRAME,      // the whole screen may have changed
+    DISPLAY_MSG_BACKLIGHT,  // switch the backlight on (len != 0) or off
+    DISPLAY_MSG_RESET       // re-initialise the controller and redraw
+};
+
+struct display_msg_t {
+    enum display_msg_type_t type;
+    int8_t row;
+    int8_t col;
+    int8_t len;
+};
+
+struct display_stats_t {
+    uint32_t i2c_writes;    // writes to the PCF8574 (one data byte each)
+    uint32_t i2c_errors;    // failed writes to the PCF8574
+    uint32_t resyncs;       // times the LCD was re-initialised after an error
+    uint32_t clk_speed;     // current I2C clock in Hz
+};
+
+extern QueueHandle_t display_queue;
+extern volatile bool display_overflow;
+
+void display_task(void *pParams);
+void display_get_stats(struct display_stats_t *pStats);
+
+#endif // DISPLAY_TASK_H
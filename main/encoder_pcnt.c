@@ -0,0 +1,181 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <driver/gpio.h>
+#include <driver/pulse_cnt.h>
+#include "esp_timer.h"
+
+#include "defines.h"
+#include "encoder_pcnt.h"
+#include "binlog.h"
+
+// Rotation is decoded in hardware by a PCNT unit, which calls back once per
+// detent. The button raises a level interrupt for the opposite of its current
+// level (the same configuration wakes the CPU from light sleep), and is then
+// debounced with a one-shot timer. Nothing runs while the knob is untouched.
+//
+// The events are the same as those from the esp-idf-lib encoder component. If
+// the knob turns the wrong way, swap RE_A_GPIO and RE_B_GPIO.
+
+static QueueHandle_t event_queue;
+static pcnt_unit_handle_t pcnt_unit;
+static bool rotation_enabled = false;
+static esp_timer_handle_t debounce_timer;
+static esp_timer_handle_t long_press_timer;
+static bool btn_pressed = false;
+static bool long_press_sent = false;
+
+
+/// @brief Sends an event to the UI.
+static void send_event(rotary_encoder_event_type_t type, int32_t diff) {
+    rotary_encoder_event_t e = { .type = type, .sender = NULL, .diff = diff };
+    if (xQueueSend(event_queue, &e, 0) != pdTRUE) {
+        BINLOG_W("encoder event queue full");
+    }
+}
+
+
+/// @brief Called from the PCNT interrupt when the count reaches a detent, either way.
+static bool on_detent(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx) {
+    BaseType_t task_woken = pdFALSE;
+    rotary_encoder_event_t e = {
+        .type = RE_ET_CHANGED,
+        .sender = NULL,
+        .diff = (edata->watch_point_value > 0) ? 1 : -1
+    };
+    xQueueSendFromISR(event_queue, &e, &task_woken);    // the count resets to zero at either limit
+    return task_woken == pdTRUE;
+}
+
+
+/// @brief Arms the button interrupt (and light sleep wakeup) for the opposite of its current level.
+static void arm_button(void) {
+    gpio_int_type_t level = gpio_get_level(RE_BTN_GPIO) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+    gpio_set_intr_type(RE_BTN_GPIO, level);
+    gpio_wakeup_enable(RE_BTN_GPIO, level);
+    gpio_intr_enable(RE_BTN_GPIO);
+}
+
+
+/// @brief Called from the GPIO interrupt when the button changes level.
+static void on_button(void *arg) {
+    gpio_intr_disable(RE_BTN_GPIO);                     // ignore bounces until the debounce timer expires
+    esp_timer_start_once(debounce_timer, RE_BTN_DEBOUNCE_US);
+}
+
+
+/// @brief Called once the button has had time to settle after a change.
+static void on_debounce(void *arg) {
+    bool pressed = (gpio_get_level(RE_BTN_GPIO) == RE_BTN_PRESSED_LEVEL);
+
+    if (pressed && !btn_pressed) {
+        long_press_sent = false;
+        esp_timer_start_once(long_press_timer, RE_BTN_LONG_PRESS_US);
+        send_event(RE_ET_BTN_PRESSED, 0);
+    } else if (!pressed && btn_pressed) {
+        esp_timer_stop(long_press_timer);
+        send_event(RE_ET_BTN_RELEASED, 0);
+        if (!long_press_sent) {
+            send_event(RE_ET_BTN_CLICKED, 0);
+        }
+    }
+    btn_pressed = pressed;
+    arm_button();
+}
+
+
+/// @brief Called if the button is still held RE_BTN_LONG_PRESS_US after being pressed.
+static void on_long_press(void *arg) {
+    if (btn_pressed) {
+        long_press_sent = true;
+        send_event(RE_ET_BTN_LONG_PRESSED, 0);
+    }
+}
+
+
+/// @brief Initialises the PCNT/interrupt driven encoder backend.
+/// @param queue where to send the rotary_encoder_event_t events
+/// @return ESP_OK, or an error code from the PCNT, GPIO or timer drivers
+esp_err_t encoder_pcnt_init(QueueHandle_t queue) {
+    esp_err_t err;
+    event_queue = queue;
+
+    // rotation: a full quadrature cycle per detent, counted on both edges of both pins
+    pcnt_unit_config_t unit_config = {
+        .low_limit = -RE_PCNT_COUNTS_PER_DETENT,
+        .high_limit = RE_PCNT_COUNTS_PER_DETENT
+    };
+    pcnt_glitch_filter_config_t filter_config = { .max_glitch_ns = RE_PCNT_GLITCH_NS };
+    pcnt_chan_config_t chan_a_config = { .edge_gpio_num = RE_A_GPIO, .level_gpio_num = RE_B_GPIO };
+    pcnt_chan_config_t chan_b_config = { .edge_gpio_num = RE_B_GPIO, .level_gpio_num = RE_A_GPIO };
+    pcnt_channel_handle_t chan_a;
+    pcnt_channel_handle_t chan_b;
+    pcnt_event_callbacks_t callbacks = { .on_reach = on_detent };
+
+    if ((err = pcnt_new_unit(&unit_config, &pcnt_unit)) != ESP_OK
+     || (err = pcnt_unit_set_glitch_filter(pcnt_unit, &filter_config)) != ESP_OK
+     || (err = pcnt_new_channel(pcnt_unit, &chan_a_config, &chan_a)) != ESP_OK
+     || (err = pcnt_new_channel(pcnt_unit, &chan_b_config, &chan_b)) != ESP_OK) {
+        return err;
+    }
+    pcnt_channel_set_edge_action(chan_a, PCNT_CHANNEL_EDGE_ACTION_DECREASE, PCNT_CHANNEL_EDGE_ACTION_INCREASE);
+    pcnt_channel_set_level_action(chan_a, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE);
+    pcnt_channel_set_edge_action(chan_b, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_DECREASE);
+    pcnt_channel_set_level_action(chan_b, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE);
+    gpio_set_pull_mode(RE_A_GPIO, GPIO_PULLUP_ONLY);
+    gpio_set_pull_mode(RE_B_GPIO, GPIO_PULLUP_ONLY);
+    pcnt_unit_add_watch_point(pcnt_unit, RE_PCNT_COUNTS_PER_DETENT);
+    pcnt_unit_add_watch_point(pcnt_unit, -RE_PCNT_COUNTS_PER_DETENT);
+    if ((err = pcnt_unit_register_event_callbacks(pcnt_unit, &callbacks, NULL)) != ESP_OK) {
+        return err;
+    }
+    encoder_pcnt_enable_rotation(true);
+
+    // button
+    esp_timer_create_args_t debounce_args = { .callback = on_debounce, .name = "re_debounce" };
+    esp_timer_create_args_t long_press_args = { .callback = on_long_press, .name = "re_long_press" };
+    if ((err = esp_timer_create(&debounce_args, &debounce_timer)) != ESP_OK
+     || (err = esp_timer_create(&long_press_args, &long_press_timer)) != ESP_OK) {
+        return err;
+    }
+
+    gpio_config_t btn_config = {
+        .pin_bit_mask = 1ull << RE_BTN_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE
+    };
+    if ((err = gpio_config(&btn_config)) != ESP_OK) {
+        return err;
+    }
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {     // it may already be installed
+        return err;
+    }
+    if ((err = gpio_isr_handler_add(RE_BTN_GPIO, on_button, NULL)) != ESP_OK) {
+        return err;
+    }
+    btn_pressed = (gpio_get_level(RE_BTN_GPIO) == RE_BTN_PRESSED_LEVEL);
+    arm_button();
+    return ESP_OK;
+}
+
+
+/// @brief Starts or stops counting rotation.
+///
+/// The glitch filter keeps the APB clock at full speed, which prevents light
+/// sleep, so rotation is stopped while the display is asleep. The button still
+/// works (and wakes the CPU).
+///
+/// @param enable true to count rotation, false to stop
+void encoder_pcnt_enable_rotation(bool enable) {
+    if (enable && !rotation_enabled) {
+        pcnt_unit_enable(pcnt_unit);
+        pcnt_unit_clear_count(pcnt_unit);
+        pcnt_unit_start(pcnt_unit);
+    } else if (!enable && rotation_enabled) {
+        pcnt_unit_stop(pcnt_unit);
+        pcnt_unit_disable(pcnt_unit);
+    }
+    rotation_enabled = enable;
+}
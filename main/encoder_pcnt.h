@@ -0,0 +1,12 @@
+#ifndef ENCODER_PCNT_H
+#define ENCODER_PCNT_H
+
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <encoder.h>                // for rotary_encoder_event_t
+
+esp_err_t encoder_pcnt_init(QueueHandle_t queue);
+void encoder_pcnt_enable_rotation(bool enable);
+
+#endif // ENCODER_PCNT_H
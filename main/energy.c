@@ -0,0 +1,230 @@
+#include <string.h>         // for memset(), memcpy()
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "energy.h"
+
+// Compressor and heater accounting for each fridge over rolling windows.
+//
+// Each window is a ring of ENERGY_BUCKETS buckets and a running total of them.
+// Events and on-times are added to the newest bucket of every window and to
+// its total. When time moves on to a new bucket, the oldest one is taken off
+// the total and reused, so updates and queries don't depend on the length of
+// the window. A window covers its length to within one bucket.
+
+enum {                                      // what's counted in each bucket
+    COUNT_STARTS,
+    COUNT_FORCED_STOPS,
+    COUNT_COMPRESSOR_MS,
+    COUNT_HEATER_MS,
+    COUNT_BLOCKED_MS,
+    NUM_COUNTS
+};
+
+struct window_t {
+    uint32_t bucket[ENERGY_BUCKETS][NUM_COUNTS];
+    uint32_t total[NUM_COUNTS];
+    int64_t current;                        // number of the newest bucket, counting from boot
+};
+
+struct fridge_energy_t {
+    struct window_t window[NUM_ENERGY_WINDOWS];
+    int64_t last_ms;                        // time of the last energy_update()
+    bool compressor_on;                     // the state since then
+    bool heater_on;
+    bool blocked;
+};
+
+static const int64_t window_ms[] = {
+    60 * 60 * 1000LL,                       // ENERGY_1H
+    24 * 60 * 60 * 1000LL,                  // ENERGY_24H
+    7 * 24 * 60 * 60 * 1000LL               // ENERGY_7D
+};
+static const uint32_t compressor_w[] = { F1_COMPRESSOR_W, F2_COMPRESSOR_W };
+static const uint32_t heater_w[] = { F1_HEATER_W, F2_HEATER_W };
+
+static portMUX_TYPE energy_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct fridge_energy_t fridge[2];
+
+
+/// @brief Moves a window on to the bucket for the current time, dropping the oldest ones.
+/// @param w the window
+/// @param bucket_ms the length of each bucket
+/// @param now_ms the time since boot
+static void advance(struct window_t *w, int64_t bucket_ms, int64_t now_ms) {
+    int64_t n = now_ms / bucket_ms;
+
+    if (n - w->current >= ENERGY_BUCKETS) {
+        memset(w, 0, sizeof(*w));           // nothing recorded for the length of the window
+        w->current = n;
+        return;
+    }
+    while (w->current < n) {
+        w->current += 1;
+        uint32_t *b = w->bucket[w->current % ENERGY_BUCKETS];
+        for (int c = 0; c < NUM_COUNTS; c += 1) {
+            w->total[c] -= b[c];
+            b[c] = 0;
+        }
+    }
+}
+
+
+/// @brief Adds to one of the counts in every window (call with energy_lock held).
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param c the count, eg. COUNT_STARTS
+/// @param n the amount to add
+/// @param now_ms the time since boot
+static void add(int fridge_num, int c, uint32_t n, int64_t now_ms) {
+    for (int i = 0; i < NUM_ENERGY_WINDOWS; i += 1) {
+        struct window_t *w = &fridge[fridge_num].window[i];
+        advance(w, window_ms[i] / ENERGY_BUCKETS, now_ms);
+        w->bucket[w->current % ENERGY_BUCKETS][c] += n;
+        w->total[c] += n;
+    }
+}
+
+
+/// @brief Counts a compressor start.
+/// @param fridge_num the index of the fridge (0 or 1)
+void energy_count_start(int fridge_num) {
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    portENTER_CRITICAL(&energy_lock);
+    add(fridge_num, COUNT_STARTS, 1, now_ms);
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+
+/// @brief Counts a compressor stop forced by MAX_COOLING_TIME.
+/// @param fridge_num the index of the fridge (0 or 1)
+void energy_count_forced_stop(int fridge_num) {
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    portENTER_CRITICAL(&energy_lock);
+    add(fridge_num, COUNT_FORCED_STOPS, 1, now_ms);
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+
+/// @brief Accounts for the time since the last update, and records the new state.
+///
+/// This is called by power_update(), so the on-times are accurate to within
+/// CONTROL_PERIOD_MS.
+///
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param compressor_on true if the compressor is now running
+/// @param heater_on true if the heater is now on
+/// @param blocked true if cooling or heating is now held off by MIN_OFF_TIME
+void energy_update(int fridge_num, bool compressor_on, bool heater_on, bool blocked) {
+    struct fridge_energy_t *f = &fridge[fridge_num];
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    portENTER_CRITICAL(&energy_lock);
+    uint32_t elapsed_ms = (uint32_t)(now_ms - f->last_ms);
+    if (f->compressor_on) {
+        add(fridge_num, COUNT_COMPRESSOR_MS, elapsed_ms, now_ms);
+    }
+    if (f->heater_on) {
+        add(fridge_num, COUNT_HEATER_MS, elapsed_ms, now_ms);
+    }
+    if (f->blocked) {
+        add(fridge_num, COUNT_BLOCKED_MS, elapsed_ms, now_ms);
+    }
+    f->last_ms = now_ms;
+    f->compressor_on = compressor_on;
+    f->heater_on = heater_on;
+    f->blocked = blocked;
+    portEXIT_CRITICAL(&energy_lock);
+}
+
+
+/// @brief Converts the counts of a bucket or window into statistics.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param counts the counts, by COUNT_STARTS etc.
+/// @param period_ms the time they cover
+/// @param pStats where to store the statistics
+static void to_stats(int fridge_num, const uint32_t *counts, int64_t period_ms, struct energy_stats_t *pStats) {
+    uint64_t mws = (uint64_t)counts[COUNT_COMPRESSOR_MS] * compressor_w[fridge_num]
+                 + (uint64_t)counts[COUNT_HEATER_MS] * heater_w[fridge_num];
+
+    pStats->period_s = period_ms / 1000;
+    pStats->starts = counts[COUNT_STARTS];
+    pStats->forced_stops = counts[COUNT_FORCED_STOPS];
+    pStats->compressor_s = counts[COUNT_COMPRESSOR_MS] / 1000;
+    pStats->heater_s = counts[COUNT_HEATER_MS] / 1000;
+    pStats->blocked_s = counts[COUNT_BLOCKED_MS] / 1000;
+    pStats->wh = mws / (60 * 60 * 1000);
+}
+
+
+/// @brief Gets the totals for a fridge over one of the rolling windows.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param window the window, eg. ENERGY_24H
+/// @param pStats where to store the totals
+void energy_get(int fridge_num, enum energy_window_t window, struct energy_stats_t *pStats) {
+    struct window_t *w = &fridge[fridge_num].window[window];
+    int64_t bucket_ms = window_ms[window] / ENERGY_BUCKETS;
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    uint32_t total[NUM_COUNTS];
+
+    portENTER_CRITICAL(&energy_lock);
+    advance(w, bucket_ms, now_ms);
+    memcpy(total, w->total, sizeof(total));
+    int64_t start_ms = (w->current - (ENERGY_BUCKETS - 1)) * bucket_ms;     // start of the oldest bucket
+    portEXIT_CRITICAL(&energy_lock);
+
+    if (start_ms < 0) {
+        start_ms = 0;
+    }
+    to_stats(fridge_num, total, now_ms - start_ms, pStats);
+}
+
+
+/// @brief Gets the buckets of one of a fridge's windows, the newest of which is still filling.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param window the window, eg. ENERGY_24H
+/// @param pFirst where to store the number of the oldest bucket, counting from boot
+/// @param pEnd where to store the number after the newest bucket
+void energy_get_range(int fridge_num, enum energy_window_t window, int64_t *pFirst, int64_t *pEnd) {
+    struct window_t *w = &fridge[fridge_num].window[window];
+    int64_t now_ms = esp_timer_get_time() / 1000;
+
+    portENTER_CRITICAL(&energy_lock);
+    advance(w, window_ms[window] / ENERGY_BUCKETS, now_ms);
+    int64_t newest = w->current;
+    portEXIT_CRITICAL(&energy_lock);
+
+    *pFirst = (newest >= ENERGY_BUCKETS) ? newest - (ENERGY_BUCKETS - 1) : 0;
+    *pEnd = newest + 1;
+}
+
+
+/// @brief Gets the totals for one bucket of a fridge's window.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param window the window, eg. ENERGY_24H
+/// @param n the number of the bucket (see energy_get_range())
+/// @param pStart_ms where to store the time at the start of the bucket
+/// @param pStats where to store the totals, whose period is the length of a bucket
+/// @return false if the bucket has been dropped from the window, or hasn't started
+bool energy_get_bucket(int fridge_num, enum energy_window_t window, int64_t n, int64_t *pStart_ms,
+                       struct energy_stats_t *pStats) {
+    struct window_t *w = &fridge[fridge_num].window[window];
+    int64_t bucket_ms = window_ms[window] / ENERGY_BUCKETS;
+    uint32_t counts[NUM_COUNTS];
+
+    portENTER_CRITICAL(&energy_lock);
+    bool valid = (n >= 0 && n <= w->current && n > w->current - ENERGY_BUCKETS);
+    if (valid) {
+        memcpy(counts, w->bucket[n % ENERGY_BUCKETS], sizeof(counts));
+    }
+    portEXIT_CRITICAL(&energy_lock);
+
+    if (!valid) {
+        return false;
+    }
+    *pStart_ms = n * bucket_ms;
+    to_stats(fridge_num, counts, bucket_ms, pStats);
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum energy_window_t {                      // rolling windows, also used by tools/telemetry_decode.py
+    ENERGY_1H,
+    ENERGY_24H,
+    ENERGY_7D,
+    NUM_ENERGY_WINDOWS
+};
+
+struct energy_stats_t {                     // sent as is in telemetry, so no padding
+    uint32_t period_s;                      // time covered by the window (less than its length after a restart)
+    uint32_t starts;                        // compressor starts
+    uint32_t forced_stops;                  // compressor stops on reaching MAX_COOLING_TIME
+    uint32_t compressor_s;                  // compressor on-time
+    uint32_t heater_s;                      // heater on-time
+    uint32_t blocked_s;                     // time cooling or heating was requested but held off by MIN_OFF_TIME
+    uint32_t wh;                            // estimated energy used, in watt-hours
+};
+
+void energy_count_start(int fridge_num);
+void energy_count_forced_stop(int fridge_num);
+void energy_update(int fridge_num, bool compressor_on, bool heater_on, bool blocked);
+void energy_get(int fridge_num, enum energy_window_t window, struct energy_stats_t *pStats);
+void energy_get_range(int fridge_num, enum energy_window_t window, int64_t *pFirst, int64_t *pEnd);
+bool energy_get_bucket(int fridge_num, enum energy_window_t window, int64_t n, int64_t *pStart_ms,
+                       struct energy_stats_t *pStats);
+
+#endif // ENERGY_H
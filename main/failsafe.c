@@ -0,0 +1,95 @@
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>      // for xTaskGetTickCount()
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "power.h"
+#include "metrics.h"
+#include "binlog.h"
+#include "failsafe.h"
+
+// Deadline monitor for the control loop.
+//
+// The UI and sensor tasks just note the tick count when they reach a
+// deadline, which costs a single store. A periodic esp_timer, which runs in
+// its own high priority task, checks how long it's been. Missing a soft
+// deadline is counted in the metrics. Missing a hard one switches off every
+// relay and SSR through power_failsafe(), and keeps them off until the
+// deadline is met again, so a stalled UI loop can't leave the compressor or
+// a heater running.
+
+static const TickType_t soft_deadline[] = {
+    pdMS_TO_TICKS(FAILSAFE_CONTROL_SOFT_MS),
+    pdMS_TO_TICKS(FAILSAFE_SENSOR_SOFT_MS)
+};
+static const TickType_t hard_deadline[] = {
+    pdMS_TO_TICKS(FAILSAFE_CONTROL_HARD_MS),
+    pdMS_TO_TICKS(FAILSAFE_SENSOR_HARD_MS)
+};
+static const enum metric_counter_t overrun_counter[] = {
+    METRIC_CONTROL_OVERRUN,
+    METRIC_SENSOR_OVERRUN
+};
+
+static volatile TickType_t last_fed[NUM_FAILSAFE_DEADLINES];
+static esp_timer_handle_t failsafe_timer;
+
+
+/// @brief Records that a deadline has been met.
+/// @param deadline the deadline, eg. FAILSAFE_CONTROL
+void failsafe_feed(enum failsafe_deadline_t deadline) {
+    last_fed[deadline] = xTaskGetTickCount();
+}
+
+
+/// @brief Checks the deadlines: called every FAILSAFE_CHECK_MS.
+static void check(void *arg) {
+    static bool late[NUM_FAILSAFE_DEADLINES];
+    static bool tripped;
+    TickType_t now = xTaskGetTickCount();
+    bool missed = false;
+
+    for (int d = 0; d < NUM_FAILSAFE_DEADLINES; d += 1) {
+        TickType_t elapsed = now - last_fed[d];
+        if (elapsed > soft_deadline[d]) {
+            if (!late[d]) {
+                metrics_count(overrun_counter[d]);      // once for each overrun
+                late[d] = true;
+            }
+        } else {
+            late[d] = false;
+        }
+        if (elapsed > hard_deadline[d]) {
+            missed = true;
+        }
+    }
+
+    if (missed) {
+        power_failsafe();
+        if (!tripped) {
+            metrics_count(METRIC_FAILSAFE);
+            BINLOG_E("failsafe: control %lu ms, sensors %lu ms since last run",
+                (unsigned long)pdTICKS_TO_MS(now - last_fed[FAILSAFE_CONTROL]),
+                (unsigned long)pdTICKS_TO_MS(now - last_fed[FAILSAFE_SENSOR]));
+        }
+    } else if (tripped) {
+        BINLOG_W("failsafe: deadlines met again");
+    }
+    tripped = missed;
+}
+
+
+/// @brief Starts the deadline monitor, once the tasks it watches have been created.
+void failsafe_init(void) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = check,
+        .name = "failsafe"
+    };
+
+    for (int d = 0; d < NUM_FAILSAFE_DEADLINES; d += 1) {
+        failsafe_feed(d);
+    }
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &failsafe_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(failsafe_timer, FAILSAFE_CHECK_MS * 1000ull));
+}
@@ -0,0 +1,13 @@
+#ifndef FAILSAFE_H
+#define FAILSAFE_H
+
+enum failsafe_deadline_t {                  // the things the monitor expects to happen regularly
+    FAILSAFE_CONTROL,                       // a control pass, ie. power_update() for both fridges
+    FAILSAFE_SENSOR,                        // a new set of readings from the sensor task
+    NUM_FAILSAFE_DEADLINES
+};
+
+void failsafe_init(void);
+void failsafe_feed(enum failsafe_deadline_t deadline);
+
+#endif // FAILSAFE_H
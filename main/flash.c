@@ -4,9 +4,13 @@
 #include "nvs.h"
 
 #include "flash.h"
+#include "binlog.h"
 
 #define NVS_NAMESPACE "brewfridge"
 #define NVS_KEYBASE "sensor_addr_"  // ... plus the sensor index
+#define NVS_KEY_LAYOUT "task_layout"
+#define NVS_KEY_PROFILE "profile_"  // ... plus the fridge number
+#define NVS_KEY_PROFILE_MIN "profile_min_"      // ... plus the fridge number
 
 static nvs_handle_t handle;
 static bool nvs_is_open = false;
@@ -26,7 +30,7 @@ static void initialise() {
 
     // open NVS for read + write
     if (nvs_open (NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
-        printf ("Error (%s) opening NVS namespace %s\n", esp_err_to_name(err), NVS_NAMESPACE);
+        BINLOG_E("Error (%s) opening NVS namespace %s", esp_err_to_name(err), NVS_NAMESPACE);
     } else {
         nvs_is_open = true;
     }
@@ -54,11 +58,12 @@ void read_sensor_addresses (struct sensor_field_t *sensors, int num_sensors) {
         // read the sensor address (if set)
         err = nvs_get_u64 (handle, key_name, &(sensors[sensor_index].addr));
         if (err == ESP_OK) {
-            printf ("NVS: %s/%s = 0x%016llx\n", NVS_NAMESPACE, key_name, sensors[sensor_index].addr);
+            BINLOG_I("NVS: %s/%s = 0x%08lx%08lx", NVS_NAMESPACE, key_name,      // (nano printf has no %llx)
+                     (unsigned long)(sensors[sensor_index].addr >> 32), (unsigned long)sensors[sensor_index].addr);
         } else if (err == ESP_ERR_NVS_NOT_FOUND) {
-                printf ("NVS: %s/%s not yet initialised\n", NVS_NAMESPACE, key_name);
+                BINLOG_I("NVS: %s/%s not yet initialised", NVS_NAMESPACE, key_name);
         } else {
-            printf ("NVS: error (%s) reading %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
+            BINLOG_E("NVS: error (%s) reading %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
         }
     }
 }
@@ -85,15 +90,143 @@ void write_sensor_addresses (struct sensor_field_t *sensors, int num_sensors) {
         // write the sensor address
         err = nvs_set_u64 (handle, key_name, sensors[sensor_index].addr);
         if (err != ESP_OK) {
-            printf ("NVS: error (%s) setting %s/%s\n", esp_err_to_name(err), NVS_NAMESPACE, key_name);
+            BINLOG_E("NVS: error (%s) setting %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
         }
     }
 
     // commit the writes
     err = nvs_commit (handle);
     if (err == ESP_OK) {
-        puts ("NVS: saved sensor addresses");
+        BINLOG_I("NVS: saved sensor addresses");
     } else {
-        printf ("NVS: error (%s) saving sensor addresses\n", esp_err_to_name(err));
+        BINLOG_E("NVS: error (%s) saving sensor addresses", esp_err_to_name(err));
+    }
+}
+
+
+/// @brief Reads the task layout from non-volatile storage.
+/// @param pLayout where to store the layout (left as it is if none has been saved)
+void read_task_layout(uint8_t *pLayout) {
+    if (nvs_is_open == false) {     // initialise the library and if necessary, the partition
+        initialise();
+    }
+
+    esp_err_t err = nvs_get_u8(handle, NVS_KEY_LAYOUT, pLayout);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        BINLOG_E("NVS: error (%s) reading %s/%s", esp_err_to_name(err), NVS_NAMESPACE, NVS_KEY_LAYOUT);
+    }
+}
+
+
+/// @brief Writes the task layout to non-volatile storage.
+/// @param layout the layout (see layout.c)
+void write_task_layout(uint8_t layout) {
+    if (nvs_is_open == false) {     // initialise the library and if necessary, the partition
+        initialise();
+    }
+
+    esp_err_t err = nvs_set_u8(handle, NVS_KEY_LAYOUT, layout);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK) {
+        BINLOG_E("NVS: error (%s) saving %s/%s", esp_err_to_name(err), NVS_NAMESPACE, NVS_KEY_LAYOUT);
+    }
+}
+
+
+/// @brief Reads a fridge's fermentation profile from non-volatile storage.
+/// @param fridge_num the fridge
+/// @param steps where to store the steps
+/// @param max_steps the space available for the steps
+/// @return the number of steps, or -1 if none have been saved
+int read_profile(int fridge_num, struct profile_step_t *steps, int max_steps) {
+    char key_name[NVS_KEY_NAME_MAX_SIZE];
+    size_t len = max_steps * sizeof(struct profile_step_t);
+
+    if (nvs_is_open == false) {     // initialise the library and if necessary, the partition
+        initialise();
+    }
+
+    snprintf(key_name, NVS_KEY_NAME_MAX_SIZE, "%s%d", NVS_KEY_PROFILE, fridge_num);
+    esp_err_t err = nvs_get_blob(handle, key_name, steps, &len);
+    if (err == ESP_OK) {
+        return len / sizeof(struct profile_step_t);
+    }
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+        BINLOG_E("NVS: error (%s) reading %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
+    }
+    return -1;
+}
+
+
+/// @brief Writes a fridge's fermentation profile to non-volatile storage.
+/// @param fridge_num the fridge
+/// @param steps the steps
+/// @param num_steps the number of steps
+void write_profile(int fridge_num, const struct profile_step_t *steps, int num_steps) {
+    char key_name[NVS_KEY_NAME_MAX_SIZE];
+
+    if (nvs_is_open == false) {     // initialise the library and if necessary, the partition
+        initialise();
+    }
+
+    snprintf(key_name, NVS_KEY_NAME_MAX_SIZE, "%s%d", NVS_KEY_PROFILE, fridge_num);
+    esp_err_t err = nvs_set_blob(handle, key_name, steps, num_steps * sizeof(struct profile_step_t));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK) {
+        BINLOG_E("NVS: error (%s) saving %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
+    }
+}
+
+
+/// @brief Reads how far a fridge's running profile had got.
+/// @param fridge_num the fridge
+/// @param pMinutes where to store the time since the profile started
+/// @return false if the profile wasn't running
+bool read_profile_progress(int fridge_num, uint32_t *pMinutes) {
+    char key_name[NVS_KEY_NAME_MAX_SIZE];
+
+    if (nvs_is_open == false) {     // initialise the library and if necessary, the partition
+        initialise();
+    }
+
+    snprintf(key_name, NVS_KEY_NAME_MAX_SIZE, "%s%d", NVS_KEY_PROFILE_MIN, fridge_num);
+    esp_err_t err = nvs_get_u32(handle, key_name, pMinutes);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        BINLOG_E("NVS: error (%s) reading %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
+    }
+    return err == ESP_OK;
+}
+
+
+/// @brief Saves how far a fridge's running profile has got, or that it isn't running.
+/// @param fridge_num the fridge
+/// @param running false if the profile has been stopped or has finished
+/// @param minutes the time since the profile started
+void write_profile_progress(int fridge_num, bool running, uint32_t minutes) {
+    char key_name[NVS_KEY_NAME_MAX_SIZE];
+    esp_err_t err;
+
+    if (nvs_is_open == false) {     // initialise the library and if necessary, the partition
+        initialise();
+    }
+
+    snprintf(key_name, NVS_KEY_NAME_MAX_SIZE, "%s%d", NVS_KEY_PROFILE_MIN, fridge_num);
+    if (running) {
+        err = nvs_set_u32(handle, key_name, minutes);
+    } else {
+        err = nvs_erase_key(handle, key_name);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK) {
+        BINLOG_E("NVS: error (%s) saving %s/%s", esp_err_to_name(err), NVS_NAMESPACE, key_name);
     }
 }
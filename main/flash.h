@@ -2,3 +2,9 @@
 
 void read_sensor_addresses(struct sensor_field_t *sensors, int num_sensors);
 void write_sensor_addresses(struct sensor_field_t *sensors, int num_sensors);
+void read_task_layout(uint8_t *pLayout);
+void write_task_layout(uint8_t layout);
+int read_profile(int fridge_num, struct profile_step_t *steps, int max_steps);
+void write_profile(int fridge_num, const struct profile_step_t *steps, int num_steps);
+bool read_profile_progress(int fridge_num, uint32_t *pMinutes);
+void write_profile_progress(int fridge_num, bool running, uint32_t minutes);
@@ -0,0 +1,303 @@
+#include <string.h>         // for memset()
+#include <math.h>           // for lroundf()
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "types.h"
+#include "history.h"
+
+// Round-robin temperature history of each sensor field, in the style of RRD.
+//
+// Every reading goes into the open bucket of each tier: 5 minutes and 1 hour.
+// When a bucket's time is up it's consolidated into a data point (min, max,
+// mean and the time spent above and below the set point) in the tier's ring,
+// and the next one is opened. So the memory used is fixed, at 10 bytes per
+// data point, and each reading costs the same however long the history.
+//
+// Each window is answered from one tier: 1 hour from the 5 minute tier, and
+// 24 hours and 7 days from the 1 hour tier. The totals of the closed buckets
+// in a window are worked out when its tier moves on, so a query only has to
+// combine them with the open bucket. A window covers its length to within a
+// bucket.
+
+struct history_point_t {                    // a closed bucket, temperatures in 1/16 C
+    int16_t min;                            // greater than max if there were no readings
+    int16_t max;
+    int16_t mean;
+    uint16_t above_s;
+    uint16_t below_s;
+};
+
+struct accumulator_t {                      // an open bucket
+    int32_t sum;
+    uint16_t count;
+    int16_t min;
+    int16_t max;
+    uint32_t above_ms;
+    uint32_t below_ms;
+};
+
+struct window_total_t {                     // the closed buckets of a window
+    int16_t min;
+    int16_t max;
+    int32_t sum_of_means;
+    uint16_t count;                         // buckets with readings
+    uint32_t above_s;
+    uint32_t below_s;
+};
+
+struct probe_t {
+    struct accumulator_t open[NUM_HISTORY_TIERS];
+    int64_t current[NUM_HISTORY_TIERS];     // number of the open bucket of each tier, counting from boot
+    struct window_total_t window[NUM_HISTORY_WINDOWS];
+    bool has_setpoint;
+    float setpoint;
+    int side;                               // of the set point at the last reading: 1 above, -1 below, otherwise 0
+    int64_t last_us;                        // time of the last reading, or 0
+};
+
+static const int64_t tier_us[] = { 5 * 60 * 1000000LL, 60 * 60 * 1000000LL };
+static const int tier_len[] = { HISTORY_5M_BUCKETS, HISTORY_1H_BUCKETS };
+static const enum history_tier_t window_tier[] = { HISTORY_TIER_5M, HISTORY_TIER_1H, HISTORY_TIER_1H };
+static const int window_len[] = { 12, 24, 7 * 24 };     // buckets, including the open one
+
+_Static_assert(HISTORY_5M_BUCKETS >= 12 && HISTORY_1H_BUCKETS >= 7 * 24, "history tiers are shorter than the windows");
+
+static portMUX_TYPE history_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct history_point_t points_5m[MAX_SENSOR_FIELDS][HISTORY_5M_BUCKETS];
+static struct history_point_t points_1h[MAX_SENSOR_FIELDS][HISTORY_1H_BUCKETS];
+static struct probe_t probe[MAX_SENSOR_FIELDS];
+
+
+/// @brief Finds a data point in the ring of a tier.
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param tier the tier, eg. HISTORY_TIER_5M
+/// @param n the number of the bucket, counting from boot
+static struct history_point_t *point(int field, enum history_tier_t tier, int64_t n) {
+    if (tier == HISTORY_TIER_5M) {
+        return &points_5m[field][n % HISTORY_5M_BUCKETS];
+    }
+    return &points_1h[field][n % HISTORY_1H_BUCKETS];
+}
+
+
+/// @brief Consolidates an open bucket into a data point, and empties it.
+static void close_bucket(struct accumulator_t *a, struct history_point_t *p) {
+    if (a->count == 0) {
+        p->min = INT16_MAX;
+        p->max = INT16_MIN;
+        p->mean = 0;
+    } else {
+        p->min = a->min;
+        p->max = a->max;
+        p->mean = a->sum / a->count;
+    }
+    p->above_s = a->above_ms / 1000;
+    p->below_s = a->below_ms / 1000;
+    memset(a, 0, sizeof(*a));
+}
+
+
+/// @brief Works out the totals of the closed buckets in a window.
+/// @param field the index of the sensor field
+/// @param window the window, eg. HISTORY_24H
+static void total_window(int field, enum history_window_t window) {
+    struct probe_t *pr = &probe[field];
+    enum history_tier_t tier = window_tier[window];
+    struct window_total_t *t = &pr->window[window];
+    int64_t first = pr->current[tier] - window_len[window] + 1;
+
+    memset(t, 0, sizeof(*t));
+    t->min = INT16_MAX;
+    t->max = INT16_MIN;
+    for (int64_t n = (first > 0) ? first : 0; n < pr->current[tier]; n += 1) {
+        const struct history_point_t *p = point(field, tier, n);
+        t->above_s += p->above_s;
+        t->below_s += p->below_s;
+        if (p->min <= p->max) {
+            t->min = (p->min < t->min) ? p->min : t->min;
+            t->max = (p->max > t->max) ? p->max : t->max;
+            t->sum_of_means += p->mean;
+            t->count += 1;
+        }
+    }
+}
+
+
+/// @brief Closes the open bucket of a tier if its time is up (call with history_lock held).
+/// @param field the index of the sensor field
+/// @param tier the tier
+/// @param now_us the time since boot
+static void advance(int field, enum history_tier_t tier, int64_t now_us) {
+    struct probe_t *pr = &probe[field];
+    int64_t n = now_us / tier_us[tier];
+    int64_t first = pr->current[tier];
+
+    if (n <= first) {
+        return;
+    }
+    if (n - first > tier_len[tier]) {
+        first = n - tier_len[tier];         // the whole ring is overwritten, the open bucket included
+        memset(&pr->open[tier], 0, sizeof(pr->open[tier]));
+    }
+    for (int64_t i = first; i < n; i += 1) {
+        close_bucket(&pr->open[tier], point(field, tier, i));   // empty after the first
+    }
+    pr->current[tier] = n;
+
+    for (int w = 0; w < NUM_HISTORY_WINDOWS; w += 1) {
+        if (window_tier[w] == tier) {
+            total_window(field, w);
+        }
+    }
+}
+
+
+/// @brief Sets the temperature that readings are counted as above or below.
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param setpoint the temperature, or UNDEFINED_TEMP
+void history_set_setpoint(int field, float setpoint) {
+    portENTER_CRITICAL(&history_lock);
+    probe[field].has_setpoint = (setpoint != UNDEFINED_TEMP);
+    probe[field].setpoint = setpoint;
+    portEXIT_CRITICAL(&history_lock);
+}
+
+
+/// @brief Adds a reading to the history of a sensor field.
+///
+/// The time since the last reading counts as above or below the set point
+/// according to the last reading, up to HISTORY_MAX_GAP_MS.
+///
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param temp the reading
+/// @param time_us the esp_timer time of the reading
+void history_add(int field, float temp, int64_t time_us) {
+    struct probe_t *pr = &probe[field];
+    int16_t t = (int16_t)lroundf(temp * 16);
+
+    portENTER_CRITICAL(&history_lock);
+    int64_t elapsed_ms = (pr->last_us != 0 && time_us > pr->last_us) ? (time_us - pr->last_us) / 1000 : 0;
+    if (elapsed_ms > HISTORY_MAX_GAP_MS) {
+        elapsed_ms = HISTORY_MAX_GAP_MS;
+    }
+
+    for (int tier = 0; tier < NUM_HISTORY_TIERS; tier += 1) {
+        struct accumulator_t *a = &pr->open[tier];
+        advance(field, tier, time_us);
+        if (pr->side > 0) {
+            a->above_ms += elapsed_ms;
+        } else if (pr->side < 0) {
+            a->below_ms += elapsed_ms;
+        }
+        if (a->count == 0 || t < a->min) {
+            a->min = t;
+        }
+        if (a->count == 0 || t > a->max) {
+            a->max = t;
+        }
+        a->sum += t;
+        a->count += 1;
+    }
+
+    pr->side = pr->has_setpoint ? (temp > pr->setpoint) - (temp < pr->setpoint) : 0;
+    pr->last_us = time_us;
+    portEXIT_CRITICAL(&history_lock);
+}
+
+
+/// @brief Gets the statistics of a sensor field over one of the windows.
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param window the window, eg. HISTORY_24H
+/// @param pStats where to store the statistics
+void history_get(int field, enum history_window_t window, struct history_stats_t *pStats) {
+    struct probe_t *pr = &probe[field];
+    enum history_tier_t tier = window_tier[window];
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&history_lock);
+    advance(field, tier, now_us);
+    struct window_total_t t = pr->window[window];
+    struct accumulator_t a = pr->open[tier];
+    int64_t start_us = (pr->current[tier] - window_len[window] + 1) * tier_us[tier];
+    portEXIT_CRITICAL(&history_lock);
+
+    if (a.count > 0) {
+        t.min = (a.min < t.min) ? a.min : t.min;
+        t.max = (a.max > t.max) ? a.max : t.max;
+        t.sum_of_means += a.sum / a.count;
+        t.count += 1;
+    }
+    if (t.count == 0) {
+        pStats->min = UNDEFINED_TEMP;
+        pStats->max = UNDEFINED_TEMP;
+        pStats->mean = UNDEFINED_TEMP;
+    } else {
+        pStats->min = t.min / 16.0f;
+        pStats->max = t.max / 16.0f;
+        pStats->mean = t.sum_of_means / (16.0f * t.count);
+    }
+    pStats->above_s = t.above_s + a.above_ms / 1000;
+    pStats->below_s = t.below_s + a.below_ms / 1000;
+    pStats->period_s = (now_us - ((start_us > 0) ? start_us : 0)) / 1000000;
+}
+
+
+/// @brief Gets the closed buckets of a tier that are still in its ring.
+///
+/// They're numbered from boot, so a caller can go through them one at a time
+/// with history_get_bucket() while readings keep arriving.
+///
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param tier the tier, eg. HISTORY_TIER_5M
+/// @param pFirst where to store the number of the oldest bucket
+/// @param pEnd where to store the number of the open bucket, after the newest closed one
+void history_get_range(int field, enum history_tier_t tier, int64_t *pFirst, int64_t *pEnd) {
+    struct probe_t *pr = &probe[field];
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&history_lock);
+    advance(field, tier, now_us);
+    int64_t end = pr->current[tier];
+    portEXIT_CRITICAL(&history_lock);
+
+    *pFirst = (end > tier_len[tier]) ? end - tier_len[tier] : 0;
+    *pEnd = end;
+}
+
+
+/// @brief Gets one of the closed buckets of a tier.
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param tier the tier, eg. HISTORY_TIER_5M
+/// @param n the number of the bucket, counting from boot (see history_get_range())
+/// @param pBucket where to store the bucket
+/// @return false if the bucket isn't closed yet, or has been overwritten
+bool history_get_bucket(int field, enum history_tier_t tier, int64_t n, struct history_bucket_t *pBucket) {
+    struct probe_t *pr = &probe[field];
+    struct history_point_t p;
+
+    portENTER_CRITICAL(&history_lock);
+    bool valid = (n >= 0 && n < pr->current[tier] && n >= pr->current[tier] - tier_len[tier]);
+    if (valid) {
+        p = *point(field, tier, n);
+    }
+    portEXIT_CRITICAL(&history_lock);
+
+    if (!valid) {
+        return false;
+    }
+    pBucket->start_us = n * tier_us[tier];
+    if (p.min > p.max) {
+        pBucket->min = UNDEFINED_TEMP;
+        pBucket->max = UNDEFINED_TEMP;
+        pBucket->mean = UNDEFINED_TEMP;
+    } else {
+        pBucket->min = p.min / 16.0f;
+        pBucket->max = p.max / 16.0f;
+        pBucket->mean = p.mean / 16.0f;
+    }
+    pBucket->above_s = p.above_s;
+    pBucket->below_s = p.below_s;
+    return true;
+}
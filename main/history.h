@@ -0,0 +1,44 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum history_window_t {                     // also used by tools/telemetry_decode.py
+    HISTORY_1H,
+    HISTORY_24H,
+    HISTORY_7D,
+    NUM_HISTORY_WINDOWS
+};
+
+enum history_tier_t {                       // the resolutions the history is kept at
+    HISTORY_TIER_5M,                        // HISTORY_5M_BUCKETS buckets of 5 minutes
+    HISTORY_TIER_1H,                        // HISTORY_1H_BUCKETS buckets of 1 hour
+    NUM_HISTORY_TIERS
+};
+
+struct history_stats_t {
+    float min;                              // UNDEFINED_TEMP if there were no readings
+    float max;
+    float mean;
+    uint32_t above_s;                       // time spent above the set point
+    uint32_t below_s;                       // time spent below the set point
+    uint32_t period_s;                      // time covered by the window (less than its length after a restart)
+};
+
+void history_set_setpoint(int field, float setpoint);
+void history_add(int field, float temp, int64_t time_us);
+struct history_bucket_t {
+    int64_t start_us;                       // esp_timer time at the start of the bucket
+    float min;                              // UNDEFINED_TEMP if there were no readings
+    float max;
+    float mean;
+    uint32_t above_s;
+    uint32_t below_s;
+};
+
+void history_get(int field, enum history_window_t window, struct history_stats_t *pStats);
+void history_get_range(int field, enum history_tier_t tier, int64_t *pFirst, int64_t *pEnd);
+bool history_get_bucket(int field, enum history_tier_t tier, int64_t n, struct history_bucket_t *pBucket);
+
+#endif // HISTORY_H
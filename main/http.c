@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>             // for atoi()
+#include <string.h>             // for strcmp()
+#include <math.h>               // for lroundf()
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "types.h"
+#include "ui_task.h"
+#include "power.h"
+#include "history.h"
+#include "energy.h"
+#include "layout.h"
+#include "profile.h"
+#include "wifi.h"
+#include "http.h"
+
+#if HTTP_ENABLE
+
+#include <esp_http_server.h>
+
+// An HTTP server for the current state, the history and the profiles:
+//
+//  GET /state                                      settings, readings and power states, as JSON
+//  GET /history?field=0&tier=5m&format=csv         a sensor field's closed buckets, oldest first
+//  GET /energy?fridge=0&window=24h&format=csv      a fridge's compressor and heater buckets, oldest first
+//  GET /profile?fridge=0                           a fridge's fermentation profile, a step a line
+//  POST /profile?fridge=0                          replaces it (and stops it), eg. "hold 18.0 4d\nrest 21.0 2d"
+//
+// There's no authentication, so the server is read-only unless
+// HTTP_PROFILE_WRITE is set, when anyone on the network can POST a profile.
+//
+// field is 0 to 5 (F1_SENSOR_BEER to F2_SENSOR_HEAT), tier 5m or 1h, fridge 0
+// or 1, window 1h, 24h or 7d, and format csv (the default) or json. Times are
+// in seconds since boot, as is uptime_s in /state. Temperatures are in C, and
+// empty in CSV or null in JSON when there were no readings.
+//
+// Responses are sent a row at a time with chunked encoding, straight from
+// the history and energy rings through one HTTP_CHUNK_SIZE buffer, so the
+// memory a response needs doesn't depend on how much history it covers. Each
+// bucket is copied out under the history or energy lock by itself, so the
+// sensor and UI tasks are never held up for longer than that.
+//
+// The server task runs below the sensor and UI tasks, on the core the task
+// layout gives it. Up to HTTP_MAX_CONNECTIONS clients can be connected at once,
+// but their requests are handled one at a time by that task. That's deliberate:
+// each response needs only the one chunk buffer, and handing requests to other
+// tasks (httpd's async handlers) would need a task, a stack and a buffer for
+// each one in flight, all competing with the sensor and UI tasks, to serve a
+// handful of clients polling short responses. A client waits at most for the
+// responses already queued ahead of it. It can be load tested with a stock client, eg.
+//
+//  wrk -c 4 -d 30s "http://<address>/history?field=0&tier=1h"
+
+struct stream_t {                           // a chunked response being sent
+    httpd_req_t *req;
+    size_t len;                             // bytes waiting in buf
+    esp_err_t err;                          // the first error, after which nothing more is sent
+    char buf[HTTP_CHUNK_SIZE];
+};
+
+static const char *field_name[] = { "F1_BEER", "F1_AIR", "F1_HEAT", "F2_BEER", "F2_AIR", "F2_HEAT" };
+static const char *tier_name[] = { "5m", "1h" };
+static const char *window_name[] = { "1h", "24h", "7d" };
+static const char *profile_state_name[] = { "off", "running", "done" };
+static const char *power_state_name[] = {
+    "off", "cool_requested", "cooling", "cool_overrun", "heat_requested", "heating"
+};
+
+
+/// @brief Sends the text waiting in the buffer as a chunk.
+static void stream_flush(struct stream_t *s) {
+    if (s->err == ESP_OK && s->len > 0) {
+        s->err = httpd_resp_send_chunk(s->req, s->buf, s->len);
+    }
+    s->len = 0;
+}
+
+
+/// @brief Adds formatted text to a response, sending what's waiting first if it doesn't fit.
+/// @param s the response
+/// @param fmt the printf() format
+static void stream_printf(struct stream_t *s, const char *fmt, ...) {
+    va_list args;
+
+    for (int attempt = 0; attempt < 2; attempt += 1) {
+        va_start(args, fmt);
+        int n = vsnprintf(s->buf + s->len, sizeof(s->buf) - s->len, fmt, args);
+        va_end(args);
+        if (n >= 0 && s->len + n < sizeof(s->buf)) {
+            s->len += n;
+            return;
+        }
+        stream_flush(s);
+    }
+}
+
+
+/// @brief Sends the rest of a response and the final empty chunk.
+/// @return ESP_OK, or the first error sending the response
+static esp_err_t stream_end(struct stream_t *s) {
+    stream_flush(s);
+    if (s->err == ESP_OK) {
+        s->err = httpd_resp_send_chunk(s->req, NULL, 0);
+    }
+    return s->err;
+}
+
+
+/// @brief Formats a temperature with one decimal place, without floating point printf.
+/// @param buf where to store the string
+/// @param buflen space available for the string and terminating '\0'
+/// @param temp the temperature, or UNDEFINED_TEMP
+/// @param undefined what to give for UNDEFINED_TEMP, eg. "null"
+/// @return the string
+static const char *temp_str(char *buf, size_t buflen, float temp, const char *undefined) {
+    if (temp == UNDEFINED_TEMP) {
+        return undefined;
+    }
+    long tenths = lroundf(temp * 10);
+    unsigned long magnitude = (tenths < 0) ? -tenths : tenths;
+    snprintf(buf, buflen, "%s%lu.%lu", (tenths < 0) ? "-" : "", magnitude / 10, magnitude % 10);
+    return buf;
+}
+
+
+/// @brief Formats one of the settings, which are kept in tenths.
+static const char *setting_str(char *buf, size_t buflen, int value) {
+    return temp_str(buf, buflen, (value == UNDEFINED_TEMP) ? UNDEFINED_TEMP : value / 10.0f, "null");
+}
+
+
+/// @brief Gets a parameter from the query string of a request.
+/// @param req the request
+/// @param key the name of the parameter
+/// @param value where to store the value
+/// @param len the space available for the value
+/// @param missing what to give if the parameter isn't there
+/// @return the value
+static const char *query_param(httpd_req_t *req, const char *key, char *value, size_t len, const char *missing) {
+    char query[64];
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+     || httpd_query_key_value(query, key, value, len) != ESP_OK) {
+        return missing;
+    }
+    return value;
+}
+
+
+/// @brief Finds a name in a list.
+/// @return its index, or -1
+static int find_name(const char **names, int num_names, const char *name) {
+    for (int i = 0; i < num_names; i += 1) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/// @brief GET /state
+static esp_err_t state_handler(httpd_req_t *req) {
+    struct stream_t s = { .req = req };
+    struct ui_state_t state;
+    char t[3][12];
+
+    ui_get_state(&state);
+    httpd_resp_set_type(req, "application/json");
+    stream_printf(&s, "{\"uptime_s\":%lu,\"fridges\":[", (unsigned long)(esp_timer_get_time() / 1000000));
+    for (int f = 0; f < 2; f += 1) {
+        struct profile_status_t p;
+        profile_get_status(f, esp_timer_get_time(), &p);
+        stream_printf(&s, "%s{\"state\":\"%s\",\"set\":%s,\"cool\":%s,\"heat\":%s,", f ? "," : "",
+                      power_state_name[power_state[f]],
+                      setting_str(t[0], sizeof(t[0]), state.set[F1_SET + f]),
+                      setting_str(t[1], sizeof(t[1]), state.set[F1_COOL + f]),
+                      setting_str(t[2], sizeof(t[2]), state.set[F1_HEAT + f]));
+        stream_printf(&s, "\"profile\":{\"state\":\"%s\",\"step\":%d,\"steps\":%d,\"type\":\"%s\",\"left_s\":%lu}}",
+                      profile_state_name[p.state], p.step + 1, p.num_steps, profile_step_name(p.type),
+                      (unsigned long)p.left_s);
+    }
+    stream_printf(&s, "],\"sensors\":{");
+    for (int field = 0; field < MAX_SENSOR_FIELDS; field += 1) {
+        stream_printf(&s, "%s\"%s\":%s", field ? "," : "", field_name[field],
+                      temp_str(t[0], sizeof(t[0]), state.temp[field], "null"));
+    }
+    stream_printf(&s, "}}\n");
+    return stream_end(&s);
+}
+
+
+/// @brief GET /history?field=&tier=&format=
+static esp_err_t history_handler(httpd_req_t *req) {
+    struct stream_t s = { .req = req };
+    char value[8];
+    char t[3][12];
+    int64_t first, end;
+
+    int field = atoi(query_param(req, "field", value, sizeof(value), "0"));
+    int tier = find_name(tier_name, NUM_HISTORY_TIERS, query_param(req, "tier", value, sizeof(value), "5m"));
+    bool json = (strcmp(query_param(req, "format", value, sizeof(value), "csv"), "json") == 0);
+    if (field < 0 || field >= MAX_SENSOR_FIELDS || tier < 0) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "field is 0-5, tier is 5m or 1h");
+    }
+    const char *undefined = json ? "null" : "";
+
+    history_get_range(field, tier, &first, &end);
+    httpd_resp_set_type(req, json ? "application/json" : "text/csv");
+    if (json) {
+        stream_printf(&s, "{\"field\":\"%s\",\"tier\":\"%s\",\"buckets\":[", field_name[field], tier_name[tier]);
+    } else {
+        stream_printf(&s, "time_s,min,max,mean,above_s,below_s\n");
+    }
+
+    bool comma = false;
+    for (int64_t n = first; n < end && s.err == ESP_OK; n += 1) {
+        struct history_bucket_t b;
+        if (!history_get_bucket(field, tier, n, &b)) {
+            continue;                       // overwritten while the response was being sent
+        }
+        stream_printf(&s, json ? "%s{\"time_s\":%lu,\"min\":%s,\"max\":%s,\"mean\":%s,\"above_s\":%lu,\"below_s\":%lu}"
+                               : "%s%lu,%s,%s,%s,%lu,%lu\n",
+                      comma ? "," : "", (unsigned long)(b.start_us / 1000000),
+                      temp_str(t[0], sizeof(t[0]), b.min, undefined),
+                      temp_str(t[1], sizeof(t[1]), b.max, undefined),
+                      temp_str(t[2], sizeof(t[2]), b.mean, undefined),
+                      (unsigned long)b.above_s, (unsigned long)b.below_s);
+        comma = json;
+    }
+
+    if (json) {
+        stream_printf(&s, "]}\n");
+    }
+    return stream_end(&s);
+}
+
+
+/// @brief GET /energy?fridge=&window=&format=
+static esp_err_t energy_handler(httpd_req_t *req) {
+    struct stream_t s = { .req = req };
+    char value[8];
+    int64_t first, end;
+
+    int fridge_num = atoi(query_param(req, "fridge", value, sizeof(value), "0"));
+    int window = find_name(window_name, NUM_ENERGY_WINDOWS, query_param(req, "window", value, sizeof(value), "24h"));
+    bool json = (strcmp(query_param(req, "format", value, sizeof(value), "csv"), "json") == 0);
+    if (fridge_num < 0 || fridge_num > 1 || window < 0) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "fridge is 0 or 1, window is 1h, 24h or 7d");
+    }
+
+    energy_get_range(fridge_num, window, &first, &end);
+    httpd_resp_set_type(req, json ? "application/json" : "text/csv");
+    if (json) {
+        stream_printf(&s, "{\"fridge\":%d,\"window\":\"%s\",\"buckets\":[", fridge_num, window_name[window]);
+    } else {
+        stream_printf(&s, "time_s,period_s,starts,forced_stops,compressor_s,heater_s,blocked_s,wh\n");
+    }
+
+    bool comma = false;
+    for (int64_t n = first; n < end && s.err == ESP_OK; n += 1) {
+        struct energy_stats_t e;
+        int64_t start_ms;
+        if (!energy_get_bucket(fridge_num, window, n, &start_ms, &e)) {
+            continue;                       // dropped while the response was being sent
+        }
+        stream_printf(&s, json ? "%s{\"time_s\":%lu,\"period_s\":%lu,\"starts\":%lu,\"forced_stops\":%lu,"
+                                 "\"compressor_s\":%lu,\"heater_s\":%lu,\"blocked_s\":%lu,\"wh\":%lu}"
+                               : "%s%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+                      comma ? "," : "", (unsigned long)(start_ms / 1000), (unsigned long)e.period_s,
+                      (unsigned long)e.starts, (unsigned long)e.forced_stops, (unsigned long)e.compressor_s,
+                      (unsigned long)e.heater_s, (unsigned long)e.blocked_s, (unsigned long)e.wh);
+        comma = json;
+    }
+
+    if (json) {
+        stream_printf(&s, "]}\n");
+    }
+    return stream_end(&s);
+}
+
+
+/// @brief Gets the fridge a /profile request is for.
+/// @return the fridge, or -1 if it isn't 0 or 1
+static int profile_fridge(httpd_req_t *req) {
+    char value[8];
+    int fridge_num = atoi(query_param(req, "fridge", value, sizeof(value), "0"));
+    return (fridge_num == 0 || fridge_num == 1) ? fridge_num : -1;
+}
+
+
+/// @brief GET /profile?fridge=
+static esp_err_t profile_get_handler(httpd_req_t *req) {
+    struct stream_t s = { .req = req };
+    struct profile_step_t steps[PROFILE_MAX_STEPS];
+    char line[32];
+
+    int fridge_num = profile_fridge(req);
+    if (fridge_num < 0) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "fridge is 0 or 1");
+    }
+    int num_steps = profile_get_steps(fridge_num, steps);
+    httpd_resp_set_type(req, "text/plain");
+    for (int i = 0; i < num_steps; i += 1) {
+        profile_format_step(line, sizeof(line), &steps[i]);
+        stream_printf(&s, "%s\n", line);
+    }
+    return stream_end(&s);
+}
+
+
+#if HTTP_PROFILE_WRITE
+/// @brief POST /profile?fridge=
+///
+/// The profile is a few hundred bytes at most, so unlike the responses it's
+/// read in one go.
+static esp_err_t profile_post_handler(httpd_req_t *req) {
+    struct profile_step_t steps[PROFILE_MAX_STEPS];
+    char text[PROFILE_MAX_STEPS * 20];
+    size_t len = 0;
+
+    int fridge_num = profile_fridge(req);
+    if (fridge_num < 0) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "fridge is 0 or 1");
+    }
+    if (req->content_len >= sizeof(text)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "profile too long");
+    }
+    while (len < req->content_len) {
+        int n = httpd_req_recv(req, text + len, req->content_len - len);
+        if (n <= 0) {
+            return ESP_FAIL;                // the connection is closed
+        }
+        len += n;
+    }
+    text[len] = '\0';
+
+    int num_steps = profile_parse(text, steps, PROFILE_MAX_STEPS);
+    if (num_steps < 0) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "expected steps like \"hold 18.0 4d\" (hold, ramp or rest; d, h or m)");
+    }
+    profile_set_steps(fridge_num, steps, num_steps);
+    return httpd_resp_sendstr(req, "ok\n");
+}
+#endif // HTTP_PROFILE_WRITE
+
+
+static const httpd_uri_t uris[] = {
+    { .uri = "/state",   .method = HTTP_GET, .handler = state_handler },
+    { .uri = "/history", .method = HTTP_GET, .handler = history_handler },
+    { .uri = "/energy",  .method = HTTP_GET, .handler = energy_handler },
+    { .uri = "/profile", .method = HTTP_GET, .handler = profile_get_handler },
+#if HTTP_PROFILE_WRITE
+    { .uri = "/profile", .method = HTTP_POST, .handler = profile_post_handler }
+#endif
+};
+
+
+/// @brief Joins the WiFi network and starts the server (call after NVS is initialised).
+void http_init(void) {
+    httpd_handle_t server;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    config.server_port = HTTP_PORT;
+    config.max_open_sockets = HTTP_MAX_CONNECTIONS;
+    config.lru_purge_enable = true;         // close the oldest connection rather than refuse a new one
+    config.stack_size = HTTP_TASK_STACK;
+    config.task_priority = HTTP_TASK_PRIORITY;
+    config.core_id = layout_core(LAYOUT_HTTP);
+
+    wifi_init();
+    ESP_ERROR_CHECK(httpd_start(&server, &config));
+    for (int i = 0; i < sizeof(uris) / sizeof(uris[0]); i += 1) {
+        ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uris[i]));
+    }
+}
+
+#endif // HTTP_ENABLE
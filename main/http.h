@@ -0,0 +1,6 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+void http_init(void);
+
+#endif // HTTP_H
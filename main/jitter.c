@@ -0,0 +1,62 @@
+#include <stdlib.h>             // for llabs()
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "metrics.h"
+#include "jitter.h"
+
+#if JITTER_ENABLE
+
+// Jitter probes, for comparing the task layouts in layout.c. Build with
+// JITTER_ENABLE set to 1 and two probes run alongside the normal tasks:
+//
+//  encoder_jitter   a periodic esp_timer at JITTER_ENCODER_US, the rate that
+//                   esp-idf-lib's encoder samples its pins at, in the same
+//                   esp_timer task on core 0
+//  control_jitter   a fixed-rate UI timer of CONTROL_PERIOD_MS, handled by the
+//                   UI task's event loop in the same way as the control loop
+//
+// Each records how far every period is from its nominal length in the
+// metrics, so the console's 'm' report gives the spread for the current
+// layout, and 'c' moves on to the next one. The encoder probe keeps the CPU
+// out of light sleep, so these builds don't save power.
+
+static esp_timer_handle_t encoder_timer;
+static int64_t last_encoder_us;
+static int64_t last_control_us;
+
+
+/// @brief Records how far the time since the last call is from its period.
+/// @param metric the histogram, eg. METRIC_ENCODER_JITTER
+/// @param pLast_us the time of the last call, or 0
+/// @param period_us the nominal period
+static void record(enum metric_t metric, int64_t *pLast_us, int64_t period_us) {
+    int64_t now_us = esp_timer_get_time();
+
+    if (*pLast_us != 0) {
+        metrics_record(metric, llabs(now_us - *pLast_us - period_us));
+    }
+    *pLast_us = now_us;
+}
+
+
+static void on_encoder_timer(void *arg) {
+    record(METRIC_ENCODER_JITTER, &last_encoder_us, JITTER_ENCODER_US);
+}
+
+
+/// @brief Starts the encoder probe.
+void jitter_init(void) {
+    esp_timer_create_args_t args = { .callback = on_encoder_timer, .name = "jitter" };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &encoder_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(encoder_timer, JITTER_ENCODER_US));
+}
+
+
+/// @brief Records a period of the control probe (the UI task calls this every CONTROL_PERIOD_MS).
+void jitter_control_tick(void) {
+    record(METRIC_CONTROL_JITTER, &last_control_us, CONTROL_PERIOD_MS * 1000LL);
+}
+
+#endif // JITTER_ENABLE
@@ -0,0 +1,7 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+void jitter_init(void);
+void jitter_control_tick(void);
+
+#endif // JITTER_H
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_system.h"         // for esp_restart()
+
+#include "defines.h"
+#include "flash.h"
+#include "layout.h"
+
+// The core that each task runs on.
+//
+// Core 0 (the PRO CPU) also runs the esp_timer task, which the encoder,
+// telemetry and fail-safe timers run in, and the interrupts of the drivers
+// installed by app_main(). The 1-Wire driver turns interrupts off on its
+// core for each bit it sends or reads, so the core that sensor_task runs on
+// decides whose timing that disturbs. The WiFi driver runs on core 0, so
+// the MQTT task does too, except in the swapped layout.
+//
+// The layout is kept in NVS. The console's 'c' key saves the next one and
+// restarts, so that one build can compare them all (see jitter.c).
+
+#define ANY     tskNO_AFFINITY
+
+struct layout_t {
+    const char *name;
+    BaseType_t core[NUM_LAYOUT_TASKS];      // by enum layout_task_t
+};
+
+static const struct layout_t layouts[] = {
+    //                display ui   sensor console binlog bench mqtt http
+    { "shared",     { ANY,    ANY, ANY,   ANY,    ANY,   ANY,  ANY, ANY } },   // the scheduler picks a core for each
+    { "split",      { 0,      0,   1,     0,      0,     0,    0,   0   } },   // the 1-Wire bus has core 1 to itself
+    { "swapped",    { 1,      1,   0,     1,      1,     1,    1,   1   } },    // the 1-Wire bus shares core 0 with the timers
+};
+
+_Static_assert(TASK_LAYOUT < sizeof(layouts) / sizeof(layouts[0]), "TASK_LAYOUT isn't one of the layouts");
+
+static uint8_t current = TASK_LAYOUT;
+
+
+/// @brief Reads the layout saved by layout_next(), if there is one (call before starting the tasks).
+void layout_init(void) {
+    read_task_layout(&current);
+    if (current >= sizeof(layouts) / sizeof(layouts[0])) {
+        current = TASK_LAYOUT;
+    }
+}
+
+
+/// @brief Gets the core that a task should run on.
+/// @param task the task, eg. LAYOUT_SENSOR
+/// @return the core, or tskNO_AFFINITY
+BaseType_t layout_core(enum layout_task_t task) {
+    if (portNUM_PROCESSORS == 1) {
+        return ANY;                         // built for a single core
+    }
+    return layouts[current].core[task];
+}
+
+
+/// @brief Gets the name of the current layout, eg. "split".
+const char *layout_name(void) {
+    return layouts[current].name;
+}
+
+
+/// @brief Saves the next layout and restarts to use it.
+void layout_next(void) {
+    uint8_t next = (current + 1) % (sizeof(layouts) / sizeof(layouts[0]));
+
+    write_task_layout(next);
+    printf("task layout %s, restarting\n", layouts[next].name);
+    fflush(stdout);
+    esp_restart();
+}
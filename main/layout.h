@@ -0,0 +1,23 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <freertos/FreeRTOS.h>
+
+enum layout_task_t {                        // the tasks that a layout places
+    LAYOUT_DISPLAY,
+    LAYOUT_UI,
+    LAYOUT_SENSOR,
+    LAYOUT_CONSOLE,
+    LAYOUT_BINLOG,
+    LAYOUT_BENCH,
+    LAYOUT_MQTT,
+    LAYOUT_HTTP,
+    NUM_LAYOUT_TASKS
+};
+
+void layout_init(void);
+BaseType_t layout_core(enum layout_task_t task);
+const char *layout_name(void);
+void layout_next(void);
+
+#endif // LAYOUT_H
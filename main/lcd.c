@@ -1,133 +1,202 @@
+#include <stdio.h>
 #include <string.h>         // for memset()
-#include <hd44780.h>
-#include <pcf8574.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include "defines.h"
+#include "lcd.h"
+#include "display_task.h"
 
-static i2c_dev_t pcf8574;   // see https://esp-idf-lib.readthedocs.io/en/latest/groups/i2cdev.html
+// The UI draws into a shadow of the screen, and the display task copies it to
+// the LCD. None of these functions touch the I2C bus, so none of them block.
 
-static unsigned char lcd_buffer[5 * 20];
+static portMUX_TYPE lcd_lock = portMUX_INITIALIZER_UNLOCKED;
+static unsigned char lcd_buffer[LCD_ROWS * LCD_COLS];
+static uint8_t lcd_glyphs[LCD_GLYPHS * LCD_GLYPH_ROWS];
 static int lcd_row;
 static int lcd_col;
 static int hidden_row;
 static int hidden_col;
-static char buf[21];
-
-
-static esp_err_t write_lcd_data(const hd44780_t *lcd, uint8_t data) {
-    return pcf8574_port_write(&pcf8574, data);
+static int hidden_len;
+
+
+/// @brief Tells the display task about a change.
+/// @param type the type of change, eg. DISPLAY_MSG_REGION
+/// @param row the row of a changed region
+/// @param col the first column of a changed region
+/// @param len the length of a changed region, or the backlight state
+static void post(enum display_msg_type_t type, int row, int col, int len) {
+    struct display_msg_t msg = { .type = type, .row = row, .col = col, .len = len };
+    if (xQueueSend(display_queue, &msg, 0) != pdTRUE) {
+        display_overflow = true;    // the display task will redraw everything
+    }
 }
 
-hd44780_t lcd = {
-        .write_cb = write_lcd_data, // use callback to send data to LCD via I2C GPIO expander
-        .font = HD44780_FONT_5X8,
-        .lines = 4,
-        .pins = {
-            .rs = 0,
-            .e  = 2,
-            .d4 = 4,
-            .d5 = 5,
-            .d6 = 6,
-            .d7 = 7,
-            .bl = 3
-        }
-    };
-
 
 void lcd_dump() {
-    for (int row = 0; row < 4; row ++) {
+    char buffer[LCD_ROWS * LCD_COLS];
+    int row, col, len;
+
+    // copy it under the lock, and print it after (printf can't run in a critical section)
+    portENTER_CRITICAL(&lcd_lock);
+    memcpy(buffer, lcd_buffer, sizeof(buffer));
+    row = hidden_row;
+    col = hidden_col;
+    len = hidden_len;
+    portEXIT_CRITICAL(&lcd_lock);
+
+    for (int r = 0; r < LCD_ROWS; r ++) {
         printf("\n");
-        for (int col = 0; col < 20; col ++) {
-            printf("%c", lcd_buffer[row * 20 + col]);
+        for (int c = 0; c < LCD_COLS; c ++) {
+            printf("%c", buffer[r * LCD_COLS + c]);
         }
     }
-    printf("\nhidden: '%s' at (%d, %d)\n", buf, hidden_col, hidden_row);
+    printf("\nhidden: %d chars at (%d, %d)\n", len, col, row);
+
+    struct display_stats_t stats;
+    display_get_stats(&stats);
+    printf("i2c: %lu Hz, %lu errors, %lu resyncs\n",
+           (unsigned long)stats.clk_speed, (unsigned long)stats.i2c_errors, (unsigned long)stats.resyncs);
 }
 
 
 void lcd_clear() {
-    hd44780_clear(&lcd);
-    memset(lcd_buffer, 0x20, 5 * 20);
+    portENTER_CRITICAL(&lcd_lock);
+    memset(lcd_buffer, 0x20, sizeof(lcd_buffer));
+    hidden_len = 0;
+    portEXIT_CRITICAL(&lcd_lock);
     lcd_row = 0;
     lcd_col = 0;
-    buf[0] = '\0';
+    post(DISPLAY_MSG_FRAME, 0, 0, 0);
 }
 
 
 void lcd_reset() {
-    ESP_ERROR_CHECK(hd44780_init(&lcd));
-    memset(lcd_buffer, 0x20, 5 * 20);
+    lcd_clear();
+    post(DISPLAY_MSG_RESET, 0, 0, 0);
 }
 
 
 void lcd_init() {
-    ESP_ERROR_CHECK(i2cdev_init());                     // initialise the I2C library
-    memset(&pcf8574, 0, sizeof(i2c_dev_t));
-    ESP_ERROR_CHECK(pcf8574_init_desc(&pcf8574,         // struct i2c_dev_t*
-                                      I2C_ADDR,         // from define.h
-                                      0,                // i2c_port_t
-                                      SDA_GPIO,         // .. .. ..
-                                      SCL_GPIO));       // .. .. ..
-
-    //pcf8574.cfg.master.clk_speed = 50000;  // reduce I2C bus speed a bit to improve noise immunity
-
-    lcd_reset();
-    hd44780_switch_backlight(&lcd, true);
+    memset(lcd_buffer, 0x20, sizeof(lcd_buffer));
 }
 
 
 void lcd_gotoxy(int x, int y) {
-    hd44780_gotoxy(&lcd, x, y);
     lcd_col = x;
     lcd_row = y;
 }
 
 
 void lcd_switch_backlight(bool state) {
-    hd44780_switch_backlight(&lcd, state);
+    post(DISPLAY_MSG_BACKLIGHT, 0, 0, state);
 }
 
 
 void lcd_putc(const char c) {
-    hd44780_putc(&lcd, c);
+    portENTER_CRITICAL(&lcd_lock);
+    lcd_buffer[lcd_row * LCD_COLS + lcd_col] = c;
+    portEXIT_CRITICAL(&lcd_lock);
+    post(DISPLAY_MSG_REGION, lcd_row, lcd_col, 1);
     lcd_col += 1;
-    if (lcd_col > 19) {
-        lcd_col = 19;
+    if (lcd_col > LCD_COLS - 1) {
+        lcd_col = LCD_COLS - 1;
     }
 }
 
 
 void lcd_puts(const char *buf) {
-    hd44780_puts(&lcd, buf);
-    int len = (int)strnlen(buf, 20);
-    if (len > (20 - lcd_col)) {
-        len = 20 - lcd_col;
+    int len = (int)strnlen(buf, LCD_COLS);
+    if (len > (LCD_COLS - lcd_col)) {
+        len = LCD_COLS - lcd_col;
     }
-    memcpy(lcd_buffer + lcd_row * 20 + lcd_col, buf, len);
+    portENTER_CRITICAL(&lcd_lock);
+    memcpy(lcd_buffer + lcd_row * LCD_COLS + lcd_col, buf, len);
+    portEXIT_CRITICAL(&lcd_lock);
+    post(DISPLAY_MSG_REGION, lcd_row, lcd_col, len);
     lcd_col += len;
 }
 
 
 void lcd_hide(int x, int y, int num_chars) {
-    if (num_chars >= sizeof(buf)) {
-        num_chars = sizeof(buf) - 1;
+    if (num_chars > LCD_COLS - x) {
+        num_chars = LCD_COLS - x;
     }
 
-    memset(buf, ' ', num_chars);
-    buf[num_chars] = '\0';
-    hd44780_gotoxy(&lcd, x, y);
-    hd44780_puts(&lcd, buf);
-
-    memcpy(buf, lcd_buffer + y * 20 + x, num_chars);
-    buf[num_chars] = '\0';
+    lcd_restore();
+    portENTER_CRITICAL(&lcd_lock);
     hidden_row = y;
     hidden_col = x;
+    hidden_len = num_chars;
+    portEXIT_CRITICAL(&lcd_lock);
+    post(DISPLAY_MSG_REGION, y, x, num_chars);
 }
 
 
 void lcd_restore(void) {
-    if (buf[0] != '\0') {
-        hd44780_gotoxy(&lcd, hidden_col, hidden_row);
-        hd44780_puts(&lcd, buf);
-        buf[0] = '\0';
+    if (hidden_len > 0) {
+        portENTER_CRITICAL(&lcd_lock);
+        int len = hidden_len;
+        hidden_len = 0;
+        portEXIT_CRITICAL(&lcd_lock);
+        post(DISPLAY_MSG_REGION, hidden_row, hidden_col, len);
+    }
+}
+
+
+/// @brief Takes a copy of the screen as it should appear, for the display task.
+/// @param frame where to store the LCD_ROWS * LCD_COLS characters, with any hidden field blanked
+/// @param focus_row where to store the row of the hidden field (the one the user is editing)
+/// @param focus_col where to store the first column of the hidden field
+/// @param focus_len where to store the length of the hidden field, or 0 if there isn't one
+void lcd_get_frame(char *frame, int *focus_row, int *focus_col, int *focus_len) {
+    portENTER_CRITICAL(&lcd_lock);
+    memcpy(frame, lcd_buffer, sizeof(lcd_buffer));
+    *focus_row = hidden_row;
+    *focus_col = hidden_col;
+    *focus_len = hidden_len;
+    portEXIT_CRITICAL(&lcd_lock);
+
+    if (*focus_len > 0) {
+        memset(frame + *focus_row * LCD_COLS + *focus_col, ' ', *focus_len);
     }
 }
+
+
+/// @brief Redefines one of the user-defined characters.
+///
+/// Only the pixel rows that differ from the current definition are passed on to
+/// the display task, which uploads just those rows to CGRAM. Any characters on
+/// the screen showing the glyph change with it, without being redrawn.
+///
+/// @param num the glyph, 0 to LCD_GLYPHS - 1, shown by the character LCD_GLYPH_CHAR(num)
+/// @param rows its LCD_GLYPH_ROWS pixel rows, top first, with the leftmost pixel in bit 4
+void lcd_set_glyph(int num, const uint8_t *rows) {
+    uint8_t *glyph = lcd_glyphs + num * LCD_GLYPH_ROWS;
+    int first = -1;
+    int last = -1;
+
+    portENTER_CRITICAL(&lcd_lock);
+    for (int row = 0; row < LCD_GLYPH_ROWS; row += 1) {
+        if (glyph[row] != rows[row]) {
+            glyph[row] = rows[row];
+            if (first < 0) {
+                first = row;
+            }
+            last = row;
+        }
+    }
+    portEXIT_CRITICAL(&lcd_lock);
+
+    if (first >= 0) {
+        post(DISPLAY_MSG_GLYPH, num, first, last - first + 1);
+    }
+}
+
+
+/// @brief Takes a copy of the user-defined characters as they should be, for the display task.
+/// @param glyphs where to store the LCD_GLYPHS * LCD_GLYPH_ROWS pixel rows
+void lcd_get_glyphs(uint8_t *glyphs) {
+    portENTER_CRITICAL(&lcd_lock);
+    memcpy(glyphs, lcd_glyphs, sizeof(lcd_glyphs));
+    portEXIT_CRITICAL(&lcd_lock);
+}
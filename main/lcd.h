@@ -2,7 +2,13 @@
 #define LCD_H
 
 #include <stdbool.h>
-#include <hd44780.h>
+#include <stdint.h>
+
+#define LCD_ROWS    4
+#define LCD_COLS    20
+#define LCD_GLYPHS          8                   // user-defined characters in CGRAM
+#define LCD_GLYPH_ROWS      8                   // pixel rows in each, 5 pixels wide
+#define LCD_GLYPH_CHAR(n)   ((char)(8 + (n)))   // the character that shows glyph n (0 would end a string)
 
 void lcd_init(void);
 void lcd_reset(void);
@@ -14,5 +20,8 @@ void lcd_switch_backlight(bool);
 void lcd_hide(int, int, int);
 void lcd_restore(void);
 void lcd_dump(void);
+void lcd_get_frame(char *, int *, int *, int *);
+void lcd_set_glyph(int, const uint8_t *);
+void lcd_get_glyphs(uint8_t *);
 
 #endif // LCD_H
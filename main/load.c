@@ -0,0 +1,113 @@
+#include <freertos/FreeRTOS.h>
+
+#include "defines.h"
+#include "load.h"
+
+// Schedules the starts of the compressors and heaters across both fridges, so
+// they don't all switch on in the same tick.
+//
+// Once a fridge could start a load, power_update() asks for it with
+// load_request(). The request waits until load_schedule(), which runs after
+// each round of power updates, grants it: with no more than LOAD_MAX_COMPRESSORS
+// or LOAD_MAX_HEATERS on at once, at least LOAD_MIN_START_GAP between any two
+// starts, and the fridge furthest from its set point first. The next
+// load_request() then starts the load, which holds its place until
+// load_release(). The gap is timed from when a relay actually switches on
+// (load_started()), so only one grant is outstanding at a time, and a grant
+// that's withdrawn before its load starts doesn't hold up the next one.
+// Everything here runs in the UI task.
+
+enum load_state_t {
+    LOAD_IDLE,
+    LOAD_WAITING,                           // requested, not yet granted
+    LOAD_GRANTED,                           // granted, to be started by the next load_request()
+    LOAD_ON
+};
+
+static const int max_loads[] = { LOAD_MAX_COMPRESSORS, LOAD_MAX_HEATERS };
+
+static enum load_state_t load_state[2][NUM_LOADS];
+static float load_error[2];
+static TickType_t last_start;
+static bool started;                        // a load has started since boot, so last_start means something
+
+
+/// @brief Sets how far a fridge is from its set point, which orders the grants.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param error the difference between the beer temperature and the set point (degrees C)
+void load_set_error(int fridge_num, float error) {
+    load_error[fridge_num] = (error < 0) ? -error : error;
+}
+
+
+/// @brief Asks to start a load.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param load the load, eg. LOAD_COMPRESSOR
+/// @return true if the load has been granted and can be switched on now, otherwise false
+bool load_request(int fridge_num, enum load_t load) {
+    switch (load_state[fridge_num][load]) {
+        case LOAD_IDLE:
+            load_state[fridge_num][load] = LOAD_WAITING;
+            return false;
+
+        case LOAD_WAITING:
+            return false;
+
+        case LOAD_GRANTED:
+        case LOAD_ON:
+            load_state[fridge_num][load] = LOAD_ON;
+            return true;
+    }
+    return false;
+}
+
+
+/// @brief Withdraws a request, or records that a load has been switched off.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param load the load, eg. LOAD_COMPRESSOR
+void load_release(int fridge_num, enum load_t load) {
+    load_state[fridge_num][load] = LOAD_IDLE;
+}
+
+
+/// @brief Records that a granted load has been switched on, which starts the gap to the next.
+/// @param now the current tick count
+void load_started(TickType_t now) {
+    last_start = now;
+    started = true;
+}
+
+
+/// @brief Grants a waiting request for a type of load, if the limits allow.
+/// @param now the current tick count
+void load_schedule(TickType_t now) {
+    bool granted = false;                   // a grant is waiting for its load to start
+
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        for (int load = 0; load < NUM_LOADS; load += 1) {
+            granted |= (load_state[fridge_num][load] == LOAD_GRANTED);
+        }
+    }
+    if (granted || (started && now - last_start < LOAD_MIN_START_GAP)) {
+        return;
+    }
+
+    for (int load = 0; load < NUM_LOADS; load += 1) {
+        int active = 0;
+        int best = -1;
+
+        for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+            enum load_state_t state = load_state[fridge_num][load];
+            if (state == LOAD_GRANTED || state == LOAD_ON) {
+                active += 1;
+            } else if (state == LOAD_WAITING && (best < 0 || load_error[fridge_num] > load_error[best])) {
+                best = fridge_num;
+            }
+        }
+
+        if (best >= 0 && active < max_loads[load]) {
+            load_state[best][load] = LOAD_GRANTED;
+            return;
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+
+enum load_t {
+    LOAD_COMPRESSOR,
+    LOAD_HEATER,
+    NUM_LOADS
+};
+
+void load_set_error(int fridge_num, float error);
+bool load_request(int fridge_num, enum load_t load);
+void load_release(int fridge_num, enum load_t load);
+void load_started(TickType_t now);
+void load_schedule(TickType_t now);
+
+#endif // LOAD_H
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>      // for xTaskGetTickCount()
+#include <driver/gpio.h>
+#include "sdkconfig.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+
+#include "defines.h"
+#include "lowpower.h"
+
+static const gpio_num_t wakeup_gpio[] = { RE_A_GPIO, RE_B_GPIO, RE_BTN_GPIO };
+static const char *mode_name[] = { "active", "sleep" };
+static const int mode_current_ua[] = { PM_IDLE_UA + PM_BACKLIGHT_UA, PM_IDLE_UA };
+
+static enum lp_mode_t lp_mode = LP_MODE_ACTIVE;
+static TickType_t mode_start;
+static TickType_t mode_ticks[LP_NUM_MODES];
+static uint32_t wakeups[LP_NUM_MODES][LP_NUM_SOURCES];
+
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t bus_lock;
+#endif
+
+
+/// @brief Enables dynamic frequency scaling and automatic light sleep, and wakeup from the encoder.
+///
+/// Light sleep also needs CONFIG_FREERTOS_USE_TICKLESS_IDLE (see sdkconfig.defaults).
+void lowpower_init() {
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = PM_MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_CPU_FREQ_MHZ,
+        .light_sleep_enable = true
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "onewire", &bus_lock));
+#endif
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+    mode_start = xTaskGetTickCount();
+}
+
+
+/// @brief Records a change between the active and sleep modes of the UI.
+/// @param mode the new mode
+void lowpower_set_mode(enum lp_mode_t mode) {
+    if (mode != lp_mode) {
+        TickType_t now = xTaskGetTickCount();
+        mode_ticks[lp_mode] += now - mode_start;
+        mode_start = now;
+        lp_mode = mode;
+    }
+}
+
+
+/// @brief Counts a task waking up from a block, in the current mode.
+/// @param source the task
+void lowpower_count_wakeup(enum lp_source_t source) {
+    wakeups[lp_mode][source] += 1;
+}
+
+
+/// @brief Sets the encoder GPIOs to wake the CPU from light sleep when they next change.
+///
+/// Light sleep can only wake on a GPIO level, so each pin is armed for the
+/// opposite of its current level. This should be called before the UI blocks
+/// when using the esp-idf-lib encoder backend (the PCNT backend arms its own).
+void lowpower_arm_wakeup() {
+    for (int i = 0; i < sizeof(wakeup_gpio) / sizeof(wakeup_gpio[0]); i += 1) {
+        gpio_wakeup_enable(wakeup_gpio[i], gpio_get_level(wakeup_gpio[i]) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    }
+}
+
+
+/// @brief Holds the CPU at full speed (and awake) for bit-banged 1-Wire I/O.
+void lowpower_bus_acquire() {
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(bus_lock);
+#endif
+}
+
+
+/// @brief Allows the CPU to slow down or sleep again after 1-Wire I/O.
+void lowpower_bus_release() {
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_release(bus_lock);
+#endif
+}
+
+
+/// @brief Prints the wakeup counts and estimated supply current for each mode.
+///
+/// This is the diagnostics console's 'p' report. The counts cover the time since
+/// boot, so leave the controller asleep for a while before asking for it.
+///
+/// The estimate is the baseline current of the mode plus PM_WAKEUP_UC of charge
+/// for each wakeup, averaged over the time spent in the mode.
+void lowpower_report() {
+    TickType_t ticks[LP_NUM_MODES];
+
+    for (int mode = 0; mode < LP_NUM_MODES; mode += 1) {
+        ticks[mode] = mode_ticks[mode];
+    }
+    ticks[lp_mode] += xTaskGetTickCount() - mode_start;
+
+    for (int mode = 0; mode < LP_NUM_MODES; mode += 1) {
+        uint32_t ms = pdTICKS_TO_MS(ticks[mode]);
+        uint32_t total_wakeups = 0;
+        for (int source = 0; source < LP_NUM_SOURCES; source += 1) {
+            total_wakeups += wakeups[mode][source];
+        }
+        uint32_t current_ua = mode_current_ua[mode];
+        if (ms > 0) {
+            current_ua += (uint64_t)total_wakeups * PM_WAKEUP_UC * 1000 / ms;
+        }
+        printf("PM: %-6s %8lu s  ui %8lu  sensor %8lu wakeups  ~%lu uA\n",
+               mode_name[mode],
+               (unsigned long)(ms / 1000),
+               (unsigned long)wakeups[mode][LP_SOURCE_UI],
+               (unsigned long)wakeups[mode][LP_SOURCE_SENSOR],
+               (unsigned long)current_ua);
+    }
+}
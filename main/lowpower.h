@@ -0,0 +1,24 @@
+#ifndef LOWPOWER_H
+#define LOWPOWER_H
+
+enum lp_mode_t {
+    LP_MODE_ACTIVE,                         // display on
+    LP_MODE_SLEEP,                          // display off, no LCD traffic
+    LP_NUM_MODES
+};
+
+enum lp_source_t {                          // tasks whose wakeups are counted
+    LP_SOURCE_UI,
+    LP_SOURCE_SENSOR,
+    LP_NUM_SOURCES
+};
+
+void lowpower_init(void);
+void lowpower_set_mode(enum lp_mode_t mode);
+void lowpower_count_wakeup(enum lp_source_t source);
+void lowpower_arm_wakeup(void);
+void lowpower_bus_acquire(void);
+void lowpower_bus_release(void);
+void lowpower_report(void);
+
+#endif // LOWPOWER_H
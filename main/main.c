@@ -2,39 +2,113 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
-#include "esp_log.h"
 
 #include "defines.h"
 #include "types.h"
 #include "lcd.h"
+#include "display_task.h"
 #include "ui_task.h"
 #include "sensor_task.h"
 #include "power.h"
+#include "lowpower.h"
+#include "bench.h"
+#include "metrics.h"
+#include "console.h"
+#include "trace.h"
+#include "binlog.h"
+#include "telemetry.h"
+#include "failsafe.h"
+#include "layout.h"
+#include "jitter.h"
+#include "mqtt.h"
+#include "http.h"
+#include "profile.h"
 
 const char* TAG = LOG_TAG;
 
+// storage for the tasks and queues, so none of it comes from the heap
+// (the ESP32 port of FreeRTOS counts stack sizes in bytes)
+static StaticTask_t display_tcb, ui_tcb, sensor_tcb, console_tcb;
+static StackType_t display_stack[DISPLAY_TASK_STACK];
+static StackType_t ui_stack[UI_TASK_STACK];
+static StackType_t sensor_stack[SENSOR_TASK_STACK];
+static StackType_t console_stack[CONSOLE_TASK_STACK];
+#if BINLOG_ENABLE
+static StaticTask_t binlog_tcb;
+static StackType_t binlog_stack[BINLOG_TASK_STACK];
+#endif
+#if MQTT_ENABLE
+static StaticTask_t mqtt_tcb;
+static StackType_t mqtt_stack[MQTT_TASK_STACK];
+#endif
+#if BENCH_ENABLE
+static StaticTask_t bench_tcb;
+static StackType_t bench_stack[BENCH_TASK_STACK];
+#endif
+
+static StaticQueue_t temperature_queue_buf, display_queue_buf;
+static uint8_t temperature_queue_storage[1 * sizeof(void *)];
+static uint8_t display_queue_storage[DISPLAY_QUEUE_SIZE * sizeof(struct display_msg_t)];
+
+
+/// @brief Creates a task in static storage, on the core the task layout gives it, and adds it to the stack report.
+/// @param fn the task function
+/// @param name the name of the task
+/// @param stack the stack
+/// @param stack_size the size of the stack in bytes
+/// @param tcb the task control block
+/// @param priority the priority of the task
+/// @param task the task in the layout, eg. LAYOUT_UI
+static void start_task(TaskFunction_t fn, const char *name, StackType_t *stack, uint32_t stack_size,
+                       StaticTask_t *tcb, UBaseType_t priority, enum layout_task_t task) {
+    TaskHandle_t handle = xTaskCreateStaticPinnedToCore(fn, name, stack_size, NULL, priority, stack, tcb,
+                                                        layout_core(task));
+    metrics_add_task(handle, stack_size);
+}
+
+
 void app_main()
 {
     puts("OK");
+    layout_init();
+    profile_init();                 // (after layout_init(), which initialises NVS)
     power_init();
+    lowpower_init();
+    console_init();
+#if BINLOG_ENABLE
+    binlog_init();
+#endif
+    telemetry_init();
+
+    temperature_queue = xQueueCreateStatic(1, sizeof(void *), temperature_queue_storage, &temperature_queue_buf);
+#if TRACE_ENABLE
+    trace_register_queue(temperature_queue, TRACE_QUEUE_TEMPERATURE);
+#endif
+    display_queue = xQueueCreateStatic(DISPLAY_QUEUE_SIZE, sizeof(struct display_msg_t), display_queue_storage, &display_queue_buf);
+    ui_init();                      // (the UI's queue set, before anything can send to it)
+
+    start_task(display_task, "display_task", display_stack, sizeof(display_stack), &display_tcb, 8, LAYOUT_DISPLAY);
 
-    temperature_queue = xQueueCreate(1, sizeof(void *));
-    if (!temperature_queue) {
-        ESP_LOGE(TAG, "can't create temperature queue");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        abort();
-    }
-
-    if (xTaskCreate(ui_task, "ui_task", configMINIMAL_STACK_SIZE * 4, NULL, 10, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "can't create ui task");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        abort();
-    }
-
-    if (xTaskCreate(sensor_task, "sensor_task", configMINIMAL_STACK_SIZE * 4, NULL, 5, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "can't create sensor task");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        abort();
-    }
+#if BENCH_ENABLE
+    start_task(bench_task, "bench_task", bench_stack, sizeof(bench_stack), &bench_tcb, 10, LAYOUT_BENCH);
+    return;
+#endif
 
+    start_task(ui_task, "ui_task", ui_stack, sizeof(ui_stack), &ui_tcb, 10, LAYOUT_UI);
+    start_task(sensor_task, "sensor_task", sensor_stack, sizeof(sensor_stack), &sensor_tcb, 5, LAYOUT_SENSOR);
+    failsafe_init();                // watch the control loop and the readings from here on
+    start_task(console_task, "console_task", console_stack, sizeof(console_stack), &console_tcb, 2, LAYOUT_CONSOLE);
+#if JITTER_ENABLE
+    jitter_init();
+#endif
+#if MQTT_ENABLE
+    mqtt_init();                    // (layout_init() has initialised NVS, which WiFi needs)
+    start_task(mqtt_task, "mqtt_task", mqtt_stack, sizeof(mqtt_stack), &mqtt_tcb, 1, LAYOUT_MQTT);
+#endif
+#if HTTP_ENABLE
+    http_init();                    // (the server allocates its own task)
+#endif
+#if BINLOG_ENABLE
+    start_task(binlog_task, "binlog_task", binlog_stack, sizeof(binlog_stack), &binlog_tcb, 1, LAYOUT_BINLOG);
+#endif
 }
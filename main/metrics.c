@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "defines.h"
+#include "metrics.h"
+#include "layout.h"
+
+#define NUM_BUCKETS     32          // bucket b holds times from 2^b to 2^(b+1) - 1 us (and 0 us in bucket 0)
+
+struct histogram_t {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t bucket[NUM_BUCKETS];
+};
+
+static const char *metric_name[] = {
+    "sensor_scan",
+    "conversion_wait",
+    "scratchpad_read",
+    "ui_loop",
+    "lcd_flush",
+    "sample_to_control",
+    "control_jitter",
+    "encoder_jitter",
+    "mqtt_per_frame"
+};
+
+static const char *counter_name[] = {
+    "temp_queue_full",
+    "telemetry_dropped",
+    "control_overrun",
+    "sensor_overrun",
+    "failsafe",
+    "mqtt_dropped"
+};
+
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct histogram_t histogram[NUM_METRICS];
+static uint32_t counter[NUM_METRIC_COUNTERS];
+static TaskHandle_t task[METRICS_MAX_TASKS];
+static uint32_t stack_size[METRICS_MAX_TASKS];
+static int num_tasks;
+
+
+/// @brief Adds a timing to a histogram.
+///
+/// This is cheap enough to leave in all the time: a count of leading zeros
+/// picks the bucket, and there's no floating point.
+///
+/// @param metric which histogram, eg. METRIC_UI_LOOP
+/// @param us the time in microseconds
+void metrics_record(enum metric_t metric, int64_t us) {
+    uint32_t t = (us < 0) ? 0 : (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+    int b = (t == 0) ? 0 : 31 - __builtin_clz(t);
+    struct histogram_t *h = &histogram[metric];
+
+    portENTER_CRITICAL(&metrics_lock);
+    if (h->count == 0 || t < h->min) {
+        h->min = t;
+    }
+    if (t > h->max) {
+        h->max = t;
+    }
+    h->count += 1;
+    h->bucket[b] += 1;
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+
+/// @brief Counts an event.
+/// @param c which counter, eg. METRIC_TEMP_QUEUE_FULL
+void metrics_count(enum metric_counter_t c) {
+    portENTER_CRITICAL(&metrics_lock);
+    counter[c] += 1;
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+
+/// @brief Adds a task to the stack high-water mark report.
+/// @param t the task handle from xTaskCreateStatic()
+/// @param size the size of its stack in bytes
+void metrics_add_task(TaskHandle_t t, uint32_t size) {
+    if (num_tasks < METRICS_MAX_TASKS) {
+        task[num_tasks] = t;
+        stack_size[num_tasks] = size;
+        num_tasks += 1;
+    }
+}
+
+
+/// @brief Estimates the 99th percentile of a histogram.
+/// @param h the histogram
+/// @return the upper bound of the bucket that holds the 99th percentile
+static uint32_t p99(const struct histogram_t *h) {
+    uint32_t rank = h->count - h->count / 100;      // ie. ceil(0.99 * count)
+    uint32_t seen = 0;
+
+    for (int b = 0; b < NUM_BUCKETS; b += 1) {
+        seen += h->bucket[b];
+        if (seen >= rank) {
+            uint32_t upper = (b == 31) ? UINT32_MAX : (2u << b) - 1;
+            return (upper < h->max) ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+/// @brief Summarises a histogram.
+/// @param metric which histogram, eg. METRIC_UI_LOOP
+/// @param pSummary where to store the summary (all zero if nothing has been recorded)
+void metrics_get(enum metric_t metric, struct metric_summary_t *pSummary) {
+    struct histogram_t h;
+
+    portENTER_CRITICAL(&metrics_lock);
+    h = histogram[metric];
+    portEXIT_CRITICAL(&metrics_lock);
+
+    pSummary->count = h.count;
+    pSummary->min = h.min;
+    pSummary->p99 = (h.count == 0) ? 0 : p99(&h);
+    pSummary->max = h.max;
+}
+
+
+/// @brief Reads a counter.
+/// @param c which counter, eg. METRIC_TEMP_QUEUE_FULL
+/// @return the number of events
+uint32_t metrics_get_count(enum metric_counter_t c) {
+    return counter[c];
+}
+
+
+/// @brief Prints the timings, counters and stack high-water marks.
+void metrics_dump() {
+    struct metric_summary_t s;
+
+    printf("\ntask layout %s\n", layout_name());
+    printf("\n%-18s %8s %10s %10s %10s\n", "metric (us)", "count", "min", "p99", "max");
+    for (int m = 0; m < NUM_METRICS; m += 1) {
+        metrics_get(m, &s);
+        if (s.count == 0) {
+            printf("%-18s %8d\n", metric_name[m], 0);
+        } else {
+            printf("%-18s %8lu %10lu %10lu %10lu\n", metric_name[m], (unsigned long)s.count,
+                   (unsigned long)s.min, (unsigned long)s.p99, (unsigned long)s.max);
+        }
+    }
+
+    for (int c = 0; c < NUM_METRIC_COUNTERS; c += 1) {
+        printf("%-18s %8lu\n", counter_name[c], (unsigned long)metrics_get_count(c));
+    }
+
+    // the stack sizes in defines.h should be the "needs" figure after a long run
+    printf("\n%-18s %8s %10s %10s\n", "stack (bytes)", "size", "used", "needs");
+    for (int i = 0; i < num_tasks; i += 1) {
+        // on the ESP32 the high-water mark is in bytes
+        unsigned used = stack_size[i] - (unsigned)uxTaskGetStackHighWaterMark(task[i]);
+        printf("%-18s %8u %10u %10u\n", pcTaskGetName(task[i]), (unsigned)stack_size[i], used, used + STACK_MARGIN);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+enum metric_t {                             // timings, each kept as a histogram
+    METRIC_SENSOR_SCAN,                     // 1-Wire ROM search
+    METRIC_CONVERSION_WAIT,                 // waiting for the sensors to convert
+    METRIC_SCRATCHPAD_READ,                 // reading one sensor
+    METRIC_UI_LOOP,                         // handling the events and timers of one UI wakeup
+    METRIC_LCD_FLUSH,                       // one display task pass that wrote to the LCD
+    METRIC_SAMPLE_TO_CONTROL,               // from a sensor reading to power_update() acting on it
+    METRIC_CONTROL_JITTER,                  // control probe period error (JITTER_ENABLE builds)
+    METRIC_ENCODER_JITTER,                  // encoder probe period error (JITTER_ENABLE builds)
+    METRIC_MQTT_PER_FRAME,                  // publishing a batch, divided by the frames in it (MQTT_ENABLE builds)
+    NUM_METRICS
+};
+
+enum metric_counter_t {                     // events that are just counted
+    METRIC_TEMP_QUEUE_FULL,                 // readings dropped by the sensor task
+    METRIC_TELEMETRY_DROPPED,               // telemetry messages dropped because the UART was busy
+    METRIC_CONTROL_OVERRUN,                 // control passes later than FAILSAFE_CONTROL_SOFT_MS
+    METRIC_SENSOR_OVERRUN,                  // readings later than FAILSAFE_SENSOR_SOFT_MS
+    METRIC_FAILSAFE,                        // hard deadlines missed, switching off all the loads
+    METRIC_MQTT_DROPPED,                    // telemetry frames dropped because the MQTT buffer was full
+    NUM_METRIC_COUNTERS
+};
+
+struct metric_summary_t {
+    uint32_t count;
+    uint32_t min;                           // times in microseconds
+    uint32_t p99;
+    uint32_t max;
+};
+
+void metrics_record(enum metric_t metric, int64_t us);
+void metrics_count(enum metric_counter_t counter);
+void metrics_add_task(TaskHandle_t task, uint32_t stack_size);
+void metrics_get(enum metric_t metric, struct metric_summary_t *pSummary);
+uint32_t metrics_get_count(enum metric_counter_t c);
+void metrics_dump(void);
+
+#endif // METRICS_H
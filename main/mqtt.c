@@ -0,0 +1,157 @@
+#include <string.h>             // for memcpy()
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "metrics.h"
+#include "binlog.h"
+#include "mqtt.h"
+
+#if MQTT_ENABLE
+
+#include <mqtt_client.h>
+#include "wifi.h"
+
+// Publishes the telemetry stream to an MQTT broker over WiFi.
+//
+// telemetry.c hands every frame it sends to the UART to mqtt_queue_frame()
+// as well, which copies it into a ring buffer and returns. If the ring is
+// full, the oldest frames are dropped (and counted) to make room, so the
+// sensor and control tasks never wait for the network. Every MQTT_BATCH_MS
+// mqtt_task() publishes the frames waiting in the ring as one message of up
+// to MQTT_MAX_BATCH bytes, at QoS 0, and only then takes them off the ring;
+// while the broker is unreachable they stay there, newest kept.
+//
+// A payload is the same COBS frames as the UART stream, so a capture from a
+// broker decodes with the same tool, eg. against mosquitto on a PC:
+//
+//  mosquitto_sub -h localhost -t brewfridge/telemetry -N | tools/telemetry_decode.py -o logs/
+//
+// The time each publish takes, divided by the frames in it, is recorded in the
+// mqtt_per_frame metric: at QoS 0 that's mostly CPU, copying into the socket.
+
+_Static_assert((MQTT_BUFFER_SIZE & (MQTT_BUFFER_SIZE - 1)) == 0, "MQTT_BUFFER_SIZE must be a power of 2");
+
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t ring[MQTT_BUFFER_SIZE];
+static uint32_t head;                       // bytes ever written to the ring, and taken off it
+static uint32_t tail;
+static uint8_t batch[MQTT_MAX_BATCH];
+static esp_mqtt_client_handle_t client;
+static volatile bool connected;
+
+
+static void on_mqtt_event(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    if (id == MQTT_EVENT_CONNECTED) {
+        connected = true;
+        BINLOG_I("MQTT: connected");
+    } else if (id == MQTT_EVENT_DISCONNECTED) {
+        connected = false;
+        BINLOG_W("MQTT: disconnected");
+    }
+}
+
+
+/// @brief Connects to the WiFi network and starts the MQTT client (call after NVS is initialised).
+///
+/// Both reconnect by themselves in the background.
+void mqtt_init(void) {
+    esp_mqtt_client_config_t mqtt_config = {
+        .broker.address.uri = MQTT_BROKER_URI
+    };
+
+    wifi_init();
+    client = esp_mqtt_client_init(&mqtt_config);
+    ESP_ERROR_CHECK(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, on_mqtt_event, NULL));
+    ESP_ERROR_CHECK(esp_mqtt_client_start(client));
+}
+
+
+/// @brief Drops the oldest frame in the ring (call with ring_lock held).
+static void drop_oldest(void) {
+    while (tail != head) {
+        uint8_t b = ring[tail % MQTT_BUFFER_SIZE];
+        tail += 1;
+        if (b == 0) {                       // the delimiter at the end of the frame
+            break;
+        }
+    }
+}
+
+
+/// @brief Queues a telemetry frame to be published, dropping the oldest ones if there isn't room.
+/// @param frame the COBS encoded frame, including its zero delimiter
+/// @param len the length of the frame
+void mqtt_queue_frame(const uint8_t *frame, size_t len) {
+    if (len > MQTT_MAX_BATCH) {
+        return;                             // could never be published
+    }
+    portENTER_CRITICAL(&ring_lock);
+    while (MQTT_BUFFER_SIZE - (head - tail) < len) {
+        drop_oldest();
+        metrics_count(METRIC_MQTT_DROPPED);
+    }
+    for (size_t i = 0; i < len; i += 1) {
+        ring[(head + i) % MQTT_BUFFER_SIZE] = frame[i];
+    }
+    head += len;
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+
+/// @brief Copies the oldest whole frames in the ring into the batch, without taking them off it.
+/// @param pStart where to store the position in the ring of the first byte copied
+/// @param pFrames where to store the number of frames copied
+/// @return the number of bytes copied
+static size_t peek_batch(uint32_t *pStart, int *pFrames) {
+    size_t len = 0;
+    size_t end = 0;                         // the end of the last whole frame
+    int frames = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    *pStart = tail;
+    while (len < MQTT_MAX_BATCH && tail + len != head) {
+        batch[len] = ring[(tail + len) % MQTT_BUFFER_SIZE];
+        len += 1;
+        if (batch[len - 1] == 0) {
+            end = len;
+            frames += 1;
+        }
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    *pFrames = frames;
+    return end;
+}
+
+
+/// @brief Publishes the queued frames in batches every MQTT_BATCH_MS.
+/// @param pParams the parameters passed by xTaskCreate(): not used.
+void mqtt_task(void *pParams) {
+    TickType_t last_wake = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(MQTT_BATCH_MS));
+
+        uint32_t start;
+        int frames;
+        size_t len;
+        while (connected && (len = peek_batch(&start, &frames)) > 0) {
+            int64_t publish_start = esp_timer_get_time();
+            if (esp_mqtt_client_publish(client, MQTT_TOPIC, (const char *)batch, len, 0, 0) < 0) {
+                break;                      // try again next time
+            }
+            metrics_record(METRIC_MQTT_PER_FRAME, (esp_timer_get_time() - publish_start) / frames);
+
+            // take the frames off the ring, unless they've been dropped meanwhile
+            portENTER_CRITICAL(&ring_lock);
+            if ((int32_t)(tail - (start + len)) < 0) {
+                tail = start + len;
+            }
+            portEXIT_CRITICAL(&ring_lock);
+        }
+    }
+}
+
+#endif // MQTT_ENABLE
@@ -0,0 +1,11 @@
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+void mqtt_init(void);
+void mqtt_queue_frame(const uint8_t *frame, size_t len);
+void mqtt_task(void *pParams);
+
+#endif // MQTT_H
@@ -3,11 +3,16 @@
 #include <driver/gpio.h>
 #include "defines.h"
 #include "types.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "energy.h"
+#include "load.h"
 
 enum power_state_t power_state[2];     // shared
 
 static const gpio_num_t gpio_fridge_relay[] = { F1_RELAY_GPIO, F2_RELAY_GPIO };
 static const gpio_num_t gpio_heater_ssr[] = { F1_SSR_GPIO, F2_SSR_GPIO };
+static volatile bool failsafe_pending[2];   // set by power_failsafe(), for power_update() to catch up
 
 
 /// @brief Initialises the power state of the fridges and the GPIO pins
@@ -26,10 +31,54 @@ void power_init() {
 }
 
 
+/// @brief Switches the fridge (compressor) relay.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param level 1 for on, 0 for off
+static void set_relay(int fridge_num, int level) {
+    gpio_set_level (gpio_fridge_relay[fridge_num], level);
+    if (level == 0) {
+        load_release(fridge_num, LOAD_COMPRESSOR);
+    } else {
+        load_started(xTaskGetTickCount());
+    }
+    TRACE(TRACE_RELAY, TRACE_F1_RELAY + fridge_num, level);
+}
+
+
+/// @brief Switches the heater SSR.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param level 1 for on, 0 for off
+static void set_heater(int fridge_num, int level) {
+    gpio_set_level (gpio_heater_ssr[fridge_num], level);
+    if (level == 0) {
+        load_release(fridge_num, LOAD_HEATER);
+    } else {
+        load_started(xTaskGetTickCount());
+    }
+    TRACE(TRACE_RELAY, TRACE_F1_SSR + fridge_num, level);
+}
+
+
+/// @brief Switches off every relay and SSR straight away.
+///
+/// This is called by the deadline monitor, from its own task, when the control
+/// loop has stalled. The next power_update() for each fridge then puts it in
+/// PWR_OFF and waits MIN_OFF_TIME before starting anything again.
+void power_failsafe(void) {
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        gpio_set_level(gpio_fridge_relay[fridge_num], 0);
+        gpio_set_level(gpio_heater_ssr[fridge_num], 0);
+        failsafe_pending[fridge_num] = true;
+    }
+}
+
+
 /// @brief Updates the power state for a fridge and controls its relay/SSR GPIOs.
 ///
 /// This function should be called frequently for each fridge, e.g. on every 
-/// iteration of the UI event loop.
+/// iteration of the UI event loop, followed by load_schedule() once both
+/// fridges have been updated. Compressor and heater starts wait for a grant
+/// from the load scheduler.
 ///
 /// @param fridge_num the index of the fridge (0 or 1)
 /// @param cool true to request cooling, otherwise false
@@ -41,6 +90,17 @@ void power_update(int fridge_num, bool cool, bool heat) {
     static TickType_t earliest_heating_start[2];
 
     TickType_t now = xTaskGetTickCount();
+    enum power_state_t before = power_state[fridge_num];
+
+    if (failsafe_pending[fridge_num]) {
+        // the relays were switched off by power_failsafe()
+        failsafe_pending[fridge_num] = false;
+        earliest_cooling_start[fridge_num] = now + MIN_OFF_TIME;
+        earliest_heating_start[fridge_num] = now + MIN_OFF_TIME;
+        set_relay(fridge_num, 0);
+        set_heater(fridge_num, 0);
+        power_state[fridge_num] = PWR_OFF;
+    }
 
     switch (power_state[fridge_num]) {
         case PWR_OFF:
@@ -57,12 +117,14 @@ void power_update(int fridge_num, bool cool, bool heat) {
         case PWR_COOL_REQUESTED:
             if (cool == false) {
                 // cancel request
+                load_release(fridge_num, LOAD_COMPRESSOR);
                 power_state[fridge_num] = PWR_OFF;
-            } else if (now >= earliest_cooling_start[fridge_num]) {
+            } else if (now >= earliest_cooling_start[fridge_num] && load_request(fridge_num, LOAD_COMPRESSOR)) {
                 // start cooling
                 earliest_cooling_stop[fridge_num] = now + MIN_COOLING_TIME;
                 latest_cooling_stop[fridge_num] = now + MAX_COOLING_TIME;
-                gpio_set_level (gpio_fridge_relay[fridge_num], 1);
+                set_relay(fridge_num, 1);
+                energy_count_start(fridge_num);
                 power_state[fridge_num] = PWR_COOLING;
             }
             break;
@@ -74,7 +136,8 @@ void power_update(int fridge_num, bool cool, bool heat) {
                 // reached MAX_COOLING_TIME
                 earliest_cooling_start[fridge_num] = now + MIN_OFF_TIME;
                 earliest_heating_start[fridge_num] = now + MIN_OFF_TIME;
-                gpio_set_level (gpio_fridge_relay[fridge_num], 0);
+                set_relay(fridge_num, 0);
+                energy_count_forced_stop(fridge_num);
                 power_state[fridge_num] = PWR_OFF;
             }
             break;
@@ -86,7 +149,7 @@ void power_update(int fridge_num, bool cool, bool heat) {
                 // stop cooling
                 earliest_cooling_start[fridge_num] = now + MIN_OFF_TIME;
                 earliest_heating_start[fridge_num] = now + MIN_OFF_TIME;
-                gpio_set_level (gpio_fridge_relay[fridge_num], 0);
+                set_relay(fridge_num, 0);
                 power_state[fridge_num] = PWR_OFF;
             }
             break;
@@ -94,10 +157,11 @@ void power_update(int fridge_num, bool cool, bool heat) {
             case PWR_HEAT_REQUESTED:
             if (heat == false) {
                 // cancel request
+                load_release(fridge_num, LOAD_HEATER);
                 power_state[fridge_num] = PWR_OFF;
-            } else if (now >= earliest_heating_start[fridge_num]) {
+            } else if (now >= earliest_heating_start[fridge_num] && load_request(fridge_num, LOAD_HEATER)) {
                 // start heating
-                gpio_set_level (gpio_heater_ssr[fridge_num], 1);
+                set_heater(fridge_num, 1);
                 power_state[fridge_num] = PWR_HEATING;
             }
             break;
@@ -106,11 +170,23 @@ void power_update(int fridge_num, bool cool, bool heat) {
             if (heat == false) {
                 // stop heating
                 earliest_cooling_start[fridge_num] = now + MIN_OFF_TIME;
-                gpio_set_level (gpio_heater_ssr[fridge_num], 0);
+                set_heater(fridge_num, 0);
                 power_state[fridge_num] = PWR_OFF;
             }
             break;
     }
+
+    if (power_state[fridge_num] != before) {
+        telemetry_send_power_state(fridge_num, before, power_state[fridge_num]);
+    }
+
+    enum power_state_t state = power_state[fridge_num];
+    energy_update(
+        fridge_num,
+        state == PWR_COOLING || state == PWR_COOL_OVERRUN,
+        state == PWR_HEATING,
+        (state == PWR_COOL_REQUESTED && now < earliest_cooling_start[fridge_num]) ||
+            (state == PWR_HEAT_REQUESTED && now < earliest_heating_start[fridge_num]));
 }
 
 
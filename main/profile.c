@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>             // for strtol()
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "types.h"
+#include "flash.h"
+#include "binlog.h"
+#include "profile.h"
+
+// Fermentation profiles: a list of steps for each fridge that sets its beer set
+// point over time. A step holds a temperature, ramps steadily to one from the
+// previous step's temperature, or is a diacetyl rest (a hold, shown as such).
+// A ramp as the first step starts at its own temperature, so holds it.
+//
+// The UI calls profile_update() on each control tick. The step in progress and
+// its start and end times are cached, so that's a comparison and, during a
+// ramp, one multiply and divide, with a step to the next entry when one ends;
+// the list is only walked on a resume.
+//
+// The profiles are kept in NVS (4 bytes a step), along with how many minutes a
+// running profile has been going, saved every PROFILE_SAVE_MS. After a restart
+// a profile carries on from the last save. There's no clock to measure the
+// time the controller was off by, so the schedule is put back by that time,
+// plus up to PROFILE_SAVE_MS.
+//
+// A fridge uses default_profile until a profile is stored for it, which can be
+// done over HTTP when HTTP_PROFILE_WRITE is set (see http.c). The console starts
+// and stops them.
+
+#define US_PER_MINUTE   (60 * 1000000LL)
+
+_Static_assert(PROFILE_MAX_TEMP < (1 << 14), "PROFILE_MAX_TEMP doesn't fit in a step");
+
+struct run_t {                              // a fridge's profile and how far it's got
+    struct profile_step_t step[PROFILE_MAX_STEPS];
+    int num_steps;
+    enum profile_state_t state;
+    int current;                            // the step in progress
+    int from;                               // the temperature it starts from, in 1/10 C
+    int64_t start_us;                       // esp_timer time at which the profile started (before boot on a resume)
+    int64_t step_start_us;                  // .. and the step in progress started
+    int64_t step_end_us;                    // .. and will end
+    int64_t saved_us;                       // when the progress was last saved
+};
+
+static const char *step_name[] = { "hold", "ramp", "rest" };
+
+// a fridge's profile until one is stored for it: a typical ale
+static const struct profile_step_t default_profile[] = {
+    { PROFILE_HOLD, 180, 4 * 24 * 60 },     // ferment at 18.0 for 4 days
+    { PROFILE_RAMP, 210, 1 * 24 * 60 },     // rise to 21.0 over a day
+    { PROFILE_REST, 210, 2 * 24 * 60 },     // diacetyl rest for 2 days
+    { PROFILE_RAMP, 20,  2 * 24 * 60 },     // cool to 2.0 over 2 days
+    { PROFILE_HOLD, 20,  3 * 24 * 60 }      // condition for 3 days
+};
+
+static portMUX_TYPE profile_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct run_t run[2];
+
+
+/// @brief Makes a step the one in progress.
+/// @param r the fridge's profile
+/// @param i the step
+/// @param start_us the esp_timer time at which it starts
+static void enter_step(struct run_t *r, int i, int64_t start_us) {
+    r->current = i;
+    r->from = r->step[(i > 0) ? i - 1 : i].temp;
+    r->step_start_us = start_us;
+    r->step_end_us = start_us + r->step[i].minutes * US_PER_MINUTE;
+}
+
+
+/// @brief Loads the profiles from NVS and resumes any that were running.
+///
+/// Call once, after NVS is initialised and before the tasks that use the profiles start.
+void profile_init(void) {
+    int64_t now_us = esp_timer_get_time();
+
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        struct run_t *r = &run[fridge_num];
+        uint32_t minutes;
+
+        r->num_steps = read_profile(fridge_num, r->step, PROFILE_MAX_STEPS);
+        if (r->num_steps < 0) {
+            r->num_steps = sizeof(default_profile) / sizeof(default_profile[0]);
+            memcpy(r->step, default_profile, sizeof(default_profile));
+        }
+        if (r->num_steps > 0 && read_profile_progress(fridge_num, &minutes)) {
+            r->state = PROFILE_RUNNING;
+            r->start_us = now_us - minutes * US_PER_MINUTE;
+            r->saved_us = now_us;
+            enter_step(r, 0, r->start_us);  // the first update catches up to the right step
+            BINLOG_I("profile: fridge %d resumed after %lu minutes", fridge_num + 1, (unsigned long)minutes);
+        }
+    }
+}
+
+
+/// @brief Works out a fridge's set point from its profile, on a control tick.
+/// @param fridge_num the fridge
+/// @param now_us the esp_timer time
+/// @return the set point in 1/10 C, or UNDEFINED_TEMP if the profile isn't running
+int profile_update(int fridge_num, int64_t now_us) {
+    struct run_t *r = &run[fridge_num];
+    int value = UNDEFINED_TEMP;
+    bool save = false;
+    bool finished = false;
+    uint32_t minutes = 0;
+
+    portENTER_CRITICAL(&profile_lock);
+    if (r->state == PROFILE_RUNNING) {
+        // move on to the next step when one ends (on a resume, there may be a few to catch up on)
+        while (now_us >= r->step_end_us && r->current + 1 < r->num_steps) {
+            enter_step(r, r->current + 1, r->step_end_us);
+        }
+
+        const struct profile_step_t *s = &r->step[r->current];
+        if (now_us >= r->step_end_us) {
+            r->state = PROFILE_DONE;
+            value = s->temp;
+            finished = true;
+        } else if (s->type == PROFILE_RAMP) {
+            value = r->from + (int)((s->temp - r->from) * (now_us - r->step_start_us)
+                                    / (r->step_end_us - r->step_start_us));
+        } else {
+            value = s->temp;
+        }
+
+        if (!finished && now_us - r->saved_us >= PROFILE_SAVE_MS * 1000LL) {
+            r->saved_us = now_us;
+            minutes = (now_us - r->start_us) / US_PER_MINUTE;
+            save = true;
+        }
+    }
+    portEXIT_CRITICAL(&profile_lock);
+
+    if (finished) {
+        BINLOG_I("profile: fridge %d finished", fridge_num + 1);
+        write_profile_progress(fridge_num, false, 0);
+    } else if (save) {
+        write_profile_progress(fridge_num, true, minutes);
+    }
+    return value;
+}
+
+
+/// @brief Gets the step a fridge's profile is on, for display.
+/// @param fridge_num the fridge
+/// @param now_us the esp_timer time
+/// @param pStatus where to store the status
+void profile_get_status(int fridge_num, int64_t now_us, struct profile_status_t *pStatus) {
+    struct run_t *r = &run[fridge_num];
+
+    portENTER_CRITICAL(&profile_lock);
+    pStatus->state = r->state;
+    pStatus->step = r->current;
+    pStatus->num_steps = r->num_steps;
+    pStatus->type = (r->num_steps > 0) ? r->step[r->current].type : PROFILE_HOLD;
+    pStatus->left_s = (r->state == PROFILE_RUNNING && r->step_end_us > now_us)
+                    ? (r->step_end_us - now_us) / 1000000 : 0;
+    portEXIT_CRITICAL(&profile_lock);
+}
+
+
+/// @brief Starts a fridge's profile from the first step.
+/// @param fridge_num the fridge
+/// @return false if the profile has no steps
+bool profile_start(int fridge_num) {
+    struct run_t *r = &run[fridge_num];
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&profile_lock);
+    bool ok = (r->num_steps > 0);
+    if (ok) {
+        r->state = PROFILE_RUNNING;
+        r->start_us = now_us;
+        r->saved_us = now_us;
+        enter_step(r, 0, now_us);
+    }
+    portEXIT_CRITICAL(&profile_lock);
+
+    if (ok) {
+        write_profile_progress(fridge_num, true, 0);
+    }
+    return ok;
+}
+
+
+/// @brief Stops a fridge's profile, leaving the set point where it is.
+/// @param fridge_num the fridge
+void profile_stop(int fridge_num) {
+    portENTER_CRITICAL(&profile_lock);
+    run[fridge_num].state = PROFILE_OFF;
+    portEXIT_CRITICAL(&profile_lock);
+    write_profile_progress(fridge_num, false, 0);
+}
+
+
+/// @brief Replaces a fridge's profile, stopping it, and stores it in NVS.
+/// @param fridge_num the fridge
+/// @param steps the steps
+/// @param num_steps the number of steps, up to PROFILE_MAX_STEPS
+void profile_set_steps(int fridge_num, const struct profile_step_t *steps, int num_steps) {
+    struct run_t *r = &run[fridge_num];
+
+    profile_stop(fridge_num);
+    portENTER_CRITICAL(&profile_lock);
+    memcpy(r->step, steps, num_steps * sizeof(struct profile_step_t));
+    r->num_steps = num_steps;
+    r->current = 0;
+    portEXIT_CRITICAL(&profile_lock);
+    write_profile(fridge_num, steps, num_steps);
+}
+
+
+/// @brief Gets a copy of a fridge's profile.
+/// @param fridge_num the fridge
+/// @param steps where to store the steps (room for PROFILE_MAX_STEPS)
+/// @return the number of steps
+int profile_get_steps(int fridge_num, struct profile_step_t *steps) {
+    struct run_t *r = &run[fridge_num];
+
+    portENTER_CRITICAL(&profile_lock);
+    int num_steps = r->num_steps;
+    memcpy(steps, r->step, num_steps * sizeof(struct profile_step_t));
+    portEXIT_CRITICAL(&profile_lock);
+    return num_steps;
+}
+
+
+/// @brief Gets the name of a kind of step, eg. "ramp".
+const char *profile_step_name(enum profile_step_type_t type) {
+    return (type < NUM_PROFILE_STEP_TYPES) ? step_name[type] : "?";
+}
+
+
+/// @brief Reads a profile written as steps like "hold 18.0 4d", separated by new lines or ';'.
+///
+/// Each step is its kind (hold, ramp or rest), the temperature in C with at most
+/// one decimal place (from PROFILE_MIN_TEMP to PROFILE_MAX_TEMP), and how long it
+/// lasts in days (d), hours (h) or minutes (m), up to 65535 minutes.
+///
+/// @param text the profile
+/// @param steps where to store the steps
+/// @param max_steps the space available for the steps
+/// @return the number of steps, or -1 if the text isn't a profile of up to max_steps steps
+int profile_parse(const char *text, struct profile_step_t *steps, int max_steps) {
+    const char *p = text;
+    char *end;
+    int num_steps = 0;
+
+    for (;;) {
+        p += strspn(p, " \t\r\n;");
+        if (*p == '\0') {
+            return num_steps;
+        }
+        if (num_steps >= max_steps) {
+            return -1;
+        }
+
+        int type = -1;
+        for (int t = 0; t < NUM_PROFILE_STEP_TYPES; t += 1) {
+            size_t len = strlen(step_name[t]);
+            if (strncmp(p, step_name[t], len) == 0 && (p[len] == ' ' || p[len] == '\t')) {
+                type = t;
+                p += len;
+            }
+        }
+        if (type < 0) {
+            return -1;
+        }
+
+        // no sign (strtol would read "-0.5" as 0, then add the .5), and the whole
+        // degrees are checked before they're scaled (strtol saturates, so can't wrap)
+        p += strspn(p, " \t");
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        long whole = strtol(p, &end, 10);
+        if (whole > PROFILE_MAX_TEMP / 10) {
+            return -1;
+        }
+        long temp = whole * 10;
+        p = end;
+        if (*p == '.') {
+            if (p[1] < '0' || p[1] > '9') {
+                return -1;
+            }
+            temp += p[1] - '0';
+            p += 2;
+        }
+
+        long duration = strtol(p, &end, 10);
+        if (end == p || duration < 0) {
+            return -1;
+        }
+        p = end;
+        long unit = (*p == 'd') ? 24 * 60 : (*p == 'h') ? 60 : (*p == 'm') ? 1 : 0;
+        if (unit == 0 || duration > UINT16_MAX / unit || temp < PROFILE_MIN_TEMP || temp > PROFILE_MAX_TEMP) {
+            return -1;
+        }
+        long minutes = duration * unit;
+        p += 1;
+        if (*p != '\0' && strchr(" \t\r\n;", *p) == NULL) {
+            return -1;
+        }
+
+        steps[num_steps] = (struct profile_step_t){ .type = type, .temp = temp, .minutes = minutes };
+        num_steps += 1;
+    }
+}
+
+
+/// @brief Writes a step the way profile_parse() reads it, eg. "hold 18.0 4d".
+/// @param buf where to store the string
+/// @param buflen space available for the string and terminating '\0'
+/// @param step the step
+void profile_format_step(char *buf, size_t buflen, const struct profile_step_t *step) {
+    unsigned long minutes = step->minutes;
+    unsigned long duration = minutes;
+    char unit = 'm';
+
+    if (minutes > 0 && minutes % (24 * 60) == 0) {
+        duration = minutes / (24 * 60);
+        unit = 'd';
+    } else if (minutes > 0 && minutes % 60 == 0) {
+        duration = minutes / 60;
+        unit = 'h';
+    }
+    snprintf(buf, buflen, "%s %u.%u %lu%c", profile_step_name(step->type),
+             (unsigned)step->temp / 10, (unsigned)step->temp % 10, duration, unit);
+}
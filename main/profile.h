@@ -0,0 +1,34 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+enum profile_state_t {
+    PROFILE_OFF,                            // not started, or stopped
+    PROFILE_RUNNING,
+    PROFILE_DONE                            // finished, holding the last step's temperature
+};
+
+struct profile_status_t {
+    enum profile_state_t state;
+    int step;                               // the step in progress, from 0
+    int num_steps;
+    enum profile_step_type_t type;          // of the step in progress
+    uint32_t left_s;                        // time left in the step
+};
+
+void profile_init(void);
+int profile_update(int fridge_num, int64_t now_us);
+void profile_get_status(int fridge_num, int64_t now_us, struct profile_status_t *pStatus);
+bool profile_start(int fridge_num);
+void profile_stop(int fridge_num);
+void profile_set_steps(int fridge_num, const struct profile_step_t *steps, int num_steps);
+int profile_get_steps(int fridge_num, struct profile_step_t *steps);
+int profile_parse(const char *text, struct profile_step_t *steps, int max_steps);
+void profile_format_step(char *buf, size_t buflen, const struct profile_step_t *step);
+const char *profile_step_name(enum profile_step_type_t type);
+
+#endif // PROFILE_H
@@ -1,81 +1,535 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <math.h>                   // floorf(), fabsf()
+#include <string.h>                 // memcpy(), memset()
+#include <onewire.h>
 #include <ds18x20.h>
-#include "esp_log.h"
+#include "esp_timer.h"              // esp_timer_get_time()
 
 #include "defines.h"
 #include "globals.h"
 #include "types.h"
+#include "alarm_search.h"
+#include "power.h"
+#include "lowpower.h"
+#include "metrics.h"
+#include "trace.h"
+#include "binlog.h"
+#include "telemetry.h"
+#include "history.h"
+#include "failsafe.h"
+
+#define DS18X20_READ_SCRATCHPAD 0xbe
+#define DS18X20_POWER_ON_TEMP   85.0        // scratchpad value before the first conversion
 
 QueueHandle_t temperature_queue;
 
+// sensor addresses and control thresholds of the sensor fields, set by the UI task
+static portMUX_TYPE field_lock = portMUX_INITIALIZER_UNLOCKED;
+static ds18x20_addr_t field_addr[MAX_SENSOR_FIELDS];
+static float field_threshold[MAX_SENSOR_FIELDS];
+static bool thresholds_changed = false;
 
-void sensor_task(void *pParams) {
-    // create double buffers on heap
+// role mode: cycles since each field's sensor was last read
+static int cycles_since_read[MAX_SENSOR_FIELDS];
+
+// fast reads of each sensor (by slot) since its last CRC-checked read
+static uint8_t fast_reads[MAX_TEMP_SENSORS];
+
+// alarm windows currently programmed into the sensors found by the last full read
+static size_t window_count;
+static ds18x20_addr_t window_addr[MAX_TEMP_SENSORS];
+static int8_t window_tl[MAX_TEMP_SENSORS];
+static int8_t window_th[MAX_TEMP_SENSORS];
+
+
+/// @brief Sets the sensor and control threshold for a sensor field.
+///
+/// In SENSOR_POLL_ROLE mode the field sets how often the sensor is read.
+/// In SENSOR_POLL_ALARM mode the alarm window of the sensor is narrowed so that
+/// it flags an alarm before its reading crosses the threshold. Only changes of
+/// whole degrees are passed on, since that's the resolution of TL/TH.
+///
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @param addr the address of the sensor assigned to the field (0 if none)
+/// @param threshold the temperature at which the control loop acts, or UNDEFINED_TEMP
+void sensor_set_field(int field, ds18x20_addr_t addr, float threshold) {
+    if (threshold != UNDEFINED_TEMP) {
+        threshold = floorf(threshold);
+    }
+    portENTER_CRITICAL(&field_lock);
+    if (field_addr[field] != addr || field_threshold[field] != threshold) {
+        field_addr[field] = addr;
+        field_threshold[field] = threshold;
+        thresholds_changed = true;
+    }
+    portEXIT_CRITICAL(&field_lock);
+}
+
+
+/// @brief Clamps a temperature to the range of the TL/TH registers.
+static int8_t clamp_alarm_temp(int temp) {
+    if (temp < -55) {
+        return -55;
+    } else if (temp > 125) {
+        return 125;
+    }
+    return (int8_t)temp;
+}
+
+
+/// @brief Programs the alarm window of a sensor around its latest reading.
+///
+/// The window is SENSOR_ALARM_MARGIN degrees either side of the reading, narrowed
+/// to any control threshold on either side. If a threshold lies within the same
+/// whole degree as the reading the sensor stays in alarm, so it's read in full
+/// on every cycle while it's close to the point where the control loop acts.
+///
+/// @param slot the index of the sensor in the window arrays
+/// @param temp the latest reading
+static void update_alarm_window(size_t slot, float temp) {
+    int reading = (int)floorf(temp);
+    int tl = reading - SENSOR_ALARM_MARGIN;
+    int th = reading + SENSOR_ALARM_MARGIN;
+
+    portENTER_CRITICAL(&field_lock);
+    for (int f = 0; f < MAX_SENSOR_FIELDS; f += 1) {
+        if (field_addr[f] == window_addr[slot] && field_threshold[f] != UNDEFINED_TEMP) {
+            int threshold = (int)field_threshold[f];
+            if (threshold <= temp && threshold > tl) {
+                tl = threshold;
+            } else if (threshold > temp && threshold < th) {
+                th = threshold;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&field_lock);
+
+    if (clamp_alarm_temp(tl) != window_tl[slot] || clamp_alarm_temp(th) != window_th[slot]) {
+        TRACE(TRACE_ONEWIRE_BEGIN, TRACE_ONEWIRE_SET_ALARM, 0);
+        esp_err_t err = alarm_set_window(ONEWIRE_GPIO, window_addr[slot], clamp_alarm_temp(tl), clamp_alarm_temp(th));
+        TRACE(TRACE_ONEWIRE_END, TRACE_ONEWIRE_SET_ALARM, err);
+        if (err == ESP_OK) {
+            window_tl[slot] = clamp_alarm_temp(tl);
+            window_th[slot] = clamp_alarm_temp(th);
+        }
+    }
+}
+
+
+/// @brief Starts a temperature conversion.
+/// @param addr the sensor address, or DS18X20_ANY for all of them
+/// @return ESP_OK if the command was sent successfully
+static esp_err_t measure(ds18x20_addr_t addr) {
+    TRACE(TRACE_ONEWIRE_BEGIN, TRACE_ONEWIRE_CONVERT, 0);
+    esp_err_t err = ds18x20_measure(ONEWIRE_GPIO, addr, false);
+    TRACE(TRACE_ONEWIRE_END, TRACE_ONEWIRE_CONVERT, err);
+    return err;
+}
+
+
+/// @brief Waits for a temperature conversion, letting the CPU slow down or sleep meanwhile.
+static void wait_for_conversion(void) {
+    int64_t start = esp_timer_get_time();
+    lowpower_bus_release();
+    vTaskDelay(pdMS_TO_TICKS(750));
+    lowpower_count_wakeup(LP_SOURCE_SENSOR);
+    lowpower_bus_acquire();
+    onewire_depower(ONEWIRE_GPIO);      // end the strong pull-up for parasite-powered sensors
+    metrics_record(METRIC_CONVERSION_WAIT, esp_timer_get_time() - start);
+}
+
+
+/// @brief Reads the temperature of a sensor, if possible without the rest of its scratchpad.
+///
+/// A fast read aborts the transfer with a bus reset after the two temperature
+/// bytes. At standard speed (about 70 us per bit and 960 us per reset) that
+/// saves 56 of the 152 bit slots of a full read:
+///
+///     sensors     full read       fast read
+///        6          70 ms           52 ms
+///       12         139 ms          104 ms
+///
+/// The CRC isn't available without the whole scratchpad, so a full read is
+/// done instead every SENSOR_CRC_CHECK_CYCLES reads of each sensor, for the
+/// first reading of a sensor, and to confirm any reading that is implausible
+/// compared with the previous one. A sensor that has gone from the bus reads
+/// as all ones, which the fast read takes as an error rather than -0.06 C.
+///
+/// @param slot the index of the sensor in the readings (not counting the dummy)
+/// @param addr the sensor address
+/// @param temp the previous reading (or UNDEFINED_TEMP), replaced by the new one
+/// @return ESP_OK if the sensor was read successfully
+static esp_err_t read_sensor_untimed(size_t slot, ds18x20_addr_t addr, float *temp) {
+    uint8_t buf[2];
+    bool verify = !SENSOR_FAST_READ
+               || fast_reads[slot] + 1 >= SENSOR_CRC_CHECK_CYCLES
+               || (uint8_t)addr != DS18B20_FAMILY_ID
+               || *temp == UNDEFINED_TEMP;
+
+    if (!verify) {
+        if (!onewire_reset(ONEWIRE_GPIO)) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        bool ok = onewire_select(ONEWIRE_GPIO, addr)
+               && onewire_write(ONEWIRE_GPIO, DS18X20_READ_SCRATCHPAD)
+               && onewire_read_bytes(ONEWIRE_GPIO, buf, sizeof(buf));
+        onewire_reset(ONEWIRE_GPIO);        // abort the rest of the scratchpad
+        if (!ok || (buf[0] == 0xff && buf[1] == 0xff)) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        float fast_temp = (int16_t)(buf[1] << 8 | buf[0]) / 16.0;
+        if (fabsf(fast_temp - *temp) <= SENSOR_PLAUSIBLE_JUMP && fast_temp != DS18X20_POWER_ON_TEMP) {
+            *temp = fast_temp;
+            fast_reads[slot] += 1;
+            return ESP_OK;
+        }
+    }
+    fast_reads[slot] = 0;
+    return ds18x20_read_temperature(ONEWIRE_GPIO, addr, temp);
+}
+
+
+/// @brief Reads the temperature of a sensor, and records how long it took.
+/// @param slot the index of the sensor in the readings (not counting the dummy)
+/// @param addr the sensor address
+/// @param temp the previous reading (or UNDEFINED_TEMP), replaced by the new one
+/// @return ESP_OK if the sensor was read successfully
+static esp_err_t read_sensor(size_t slot, ds18x20_addr_t addr, float *temp) {
+    int64_t start = esp_timer_get_time();
+    TRACE(TRACE_ONEWIRE_BEGIN, TRACE_ONEWIRE_READ, 0);
+    esp_err_t err = read_sensor_untimed(slot, addr, temp);
+    TRACE(TRACE_ONEWIRE_END, TRACE_ONEWIRE_READ, err);
+    metrics_record(METRIC_SCRATCHPAD_READ, esp_timer_get_time() - start);
+    return err;
+}
+
+
+/// @brief Finds the previous reading of a sensor.
+/// @param pLast the previous set of readings
+/// @param slot the index of the sensor in the new set of readings (not counting the dummy)
+/// @param addr the sensor address
+/// @return the previous reading, or UNDEFINED_TEMP if there isn't one
+static float last_temp(const struct temp_data_t *pLast, size_t slot, ds18x20_addr_t addr) {
+    if (pLast != NULL && slot + 1 < pLast->num_sensors && pLast->addr[slot + 1] == addr) {
+        return pLast->temp[slot + 1];
+    }
+    return UNDEFINED_TEMP;
+}
+
+
+/// @brief Scans the bus and reads every sensor.
+/// @param pBuf where to store the readings (the first slot is reserved for the dummy)
+/// @param pLast the previous set of readings, or NULL if there aren't any
+/// @return ESP_OK if the sensors were read successfully
+static esp_err_t read_all(struct temp_data_t *pBuf, const struct temp_data_t *pLast) {
+    int64_t start = esp_timer_get_time();
+    TRACE(TRACE_ONEWIRE_BEGIN, TRACE_ONEWIRE_SCAN, 0);
+    esp_err_t err = ds18x20_scan_devices(ONEWIRE_GPIO, pBuf->addr + 1, MAX_TEMP_SENSORS, &(pBuf->num_sensors));
+    TRACE(TRACE_ONEWIRE_END, TRACE_ONEWIRE_SCAN, err);
+    metrics_record(METRIC_SENSOR_SCAN, esp_timer_get_time() - start);
+    if (err == ESP_OK) {
+        if (pBuf->num_sensors > MAX_TEMP_SENSORS) {
+            pBuf->num_sensors = MAX_TEMP_SENSORS;
+        }
+        err = measure(DS18X20_ANY);
+    }
+    if (err == ESP_OK) {
+        wait_for_conversion();
+    }
+
+    // read sensors, skip dummy
     //
-    struct temp_data_t *pTempData_A = malloc(sizeof(struct temp_data_t));
-    struct temp_data_t *pTempData_B = malloc(sizeof(struct temp_data_t));
+    for (size_t slot = 0; err == ESP_OK && slot < pBuf->num_sensors; slot += 1) {
+        pBuf->temp[slot + 1] = last_temp(pLast, slot, pBuf->addr[slot + 1]);
+        err = read_sensor(slot, pBuf->addr[slot + 1], pBuf->temp + slot + 1);
+    }
+    return err;
+}
+
+
+/// @brief Reads every sensor and reprograms all of their alarm windows.
+/// @param pBuf where to store the readings (the first slot is reserved for the dummy)
+/// @param pLast the previous set of readings, or NULL if there aren't any
+/// @return ESP_OK if the sensors were read successfully
+static esp_err_t read_all_and_set_alarms(struct temp_data_t *pBuf, const struct temp_data_t *pLast) {
+    esp_err_t err = read_all(pBuf, pLast);
+    if (err != ESP_OK) {
+        window_count = 0;
+        return err;
+    }
+
+    for (size_t slot = 0; slot < pBuf->num_sensors; slot += 1) {
+        if (slot >= window_count || window_addr[slot] != pBuf->addr[slot + 1]) {
+            window_addr[slot] = pBuf->addr[slot + 1];
+            window_tl[slot] = 0;                        // force the window to be written
+            window_th[slot] = 0;
+        }
+        update_alarm_window(slot, pBuf->temp[slot + 1]);
+    }
+    window_count = pBuf->num_sensors;
+    return ESP_OK;
+}
+
+
+/// @brief Copies the previous set of readings, not counting the dummy.
+/// @param pBuf where to store the readings
+/// @param pLast the previous set of readings
+static void carry_forward(struct temp_data_t *pBuf, const struct temp_data_t *pLast) {
+    pBuf->num_sensors = pLast->num_sensors - 1;
+    memcpy(pBuf->addr, pLast->addr, sizeof(pBuf->addr));
+    memcpy(pBuf->temp, pLast->temp, sizeof(pBuf->temp));
+}
+
 
-    if (pTempData_A == NULL || pTempData_B == NULL) {
-        ESP_LOGE(TAG, "can't malloc temp double buffer");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        abort();
+/// @brief Starts a conversion on every sensor and reads only those in alarm.
+///
+/// The readings of the other sensors are carried over from the previous buffer,
+/// since they're known to be within their alarm windows.
+///
+/// @param pBuf where to store the readings (the first slot is reserved for the dummy)
+/// @param pLast the previous set of readings
+/// @param rescan set to true if an unknown sensor responded to the alarm search
+/// @return ESP_OK if the sensors were read successfully
+static esp_err_t read_alarmed(struct temp_data_t *pBuf, const struct temp_data_t *pLast, bool *rescan) {
+    ds18x20_addr_t alarmed[MAX_TEMP_SENSORS];
+    size_t num_alarmed;
+
+    carry_forward(pBuf, pLast);
+
+    esp_err_t err = measure(DS18X20_ANY);
+    if (err == ESP_OK) {
+        wait_for_conversion();
+        int64_t start = esp_timer_get_time();
+        TRACE(TRACE_ONEWIRE_BEGIN, TRACE_ONEWIRE_ALARM_SEARCH, 0);
+        err = alarm_search_devices(ONEWIRE_GPIO, alarmed, MAX_TEMP_SENSORS, &num_alarmed);
+        TRACE(TRACE_ONEWIRE_END, TRACE_ONEWIRE_ALARM_SEARCH, err);
+        metrics_record(METRIC_SENSOR_SCAN, esp_timer_get_time() - start);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (num_alarmed > MAX_TEMP_SENSORS) {
+        num_alarmed = MAX_TEMP_SENSORS;
+        *rescan = true;
+    }
+
+    for (size_t i = 0; i < num_alarmed; i += 1) {
+        size_t slot;
+        for (slot = 0; slot < window_count; slot += 1) {
+            if (window_addr[slot] == alarmed[i]) {
+                break;
+            }
+        }
+        if (slot == window_count || window_addr[slot] != pBuf->addr[slot + 1]) {
+            *rescan = true;                             // sensor wasn't there at the last full read
+            continue;
+        }
+
+        err = read_sensor(slot, alarmed[i], pBuf->temp + slot + 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        update_alarm_window(slot, pBuf->temp[slot + 1]);
+    }
+    return ESP_OK;
+}
+
+
+/// @brief Determines how often the sensor of a field should be read.
+///
+/// The air and heater temperatures change within seconds while the fridge is
+/// cooling or heating, and that's when the control loop depends on them. The
+/// beer temperature changes over hours.
+///
+/// @param field the index of the sensor field, eg. F1_SENSOR_BEER
+/// @return the number of cycles between readings
+static int read_interval(int field) {
+    enum power_state_t state = power_state[field / SENSOR_FIELDS_PER_FRIDGE];
+
+    switch (field % SENSOR_FIELDS_PER_FRIDGE) {
+        case F1_SENSOR_AIR:
+            if (state == PWR_COOLING || state == PWR_COOL_OVERRUN) {
+                return SENSOR_ACTIVE_CYCLES;
+            }
+            return SENSOR_IDLE_CYCLES;
+
+        case F1_SENSOR_HEAT:
+            if (state == PWR_HEATING) {
+                return SENSOR_ACTIVE_CYCLES;
+            }
+            return SENSOR_IDLE_CYCLES;
+
+        default:
+            return SENSOR_BEER_CYCLES;
+    }
+}
+
+
+/// @brief Converts and reads only the sensors that are due according to their field.
+///
+/// Each due sensor is started with a Match ROM conversion so the conversions run
+/// in parallel. This relies on the sensors being externally powered, since the
+/// next reset ends the strong pull-up needed by parasite-powered ones. Sensors
+/// that aren't assigned to a field are only read by the periodic full read.
+///
+/// @param pBuf where to store the readings (the first slot is reserved for the dummy)
+/// @param pLast the previous set of readings
+/// @return ESP_OK if the sensors were read successfully
+static esp_err_t read_scheduled(struct temp_data_t *pBuf, const struct temp_data_t *pLast) {
+    bool due[MAX_TEMP_SENSORS] = { false };
+    esp_err_t err = ESP_OK;
+
+    carry_forward(pBuf, pLast);
+
+    // mark the slots of the sensors that are due (a sensor may be assigned to more than one field)
+    portENTER_CRITICAL(&field_lock);
+    for (int f = 0; f < MAX_SENSOR_FIELDS; f += 1) {
+        cycles_since_read[f] += 1;
+        if (field_addr[f] == 0 || cycles_since_read[f] < read_interval(f)) {
+            continue;
+        }
+        for (size_t slot = 0; slot < pBuf->num_sensors; slot += 1) {
+            if (pBuf->addr[slot + 1] == field_addr[f]) {
+                due[slot] = true;
+                cycles_since_read[f] = 0;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&field_lock);
+
+    for (size_t slot = 0; err == ESP_OK && slot < pBuf->num_sensors; slot += 1) {
+        if (due[slot]) {
+            err = measure(pBuf->addr[slot + 1]);
+        }
     }
+    wait_for_conversion();              // (even if there weren't any, to keep the cycle time)
 
-    struct temp_data_t *pBuf = pTempData_A;
+    for (size_t slot = 0; err == ESP_OK && slot < pBuf->num_sensors; slot += 1) {
+        if (due[slot]) {
+            err = read_sensor(slot, pBuf->addr[slot + 1], pBuf->temp + slot + 1);
+        }
+    }
+    return err;
+}
+
+
+/// @brief Adds the readings of the sensors assigned to fields to their history.
+/// @param pBuf the readings, including the dummy first one
+/// @return true if at least one field had a reading
+static bool record_history(const struct temp_data_t *pBuf) {
+    ds18x20_addr_t addr[MAX_SENSOR_FIELDS];
+    bool any = false;
+
+    portENTER_CRITICAL(&field_lock);
+    memcpy(addr, field_addr, sizeof(addr));
+    portEXIT_CRITICAL(&field_lock);
+
+    for (int f = 0; f < MAX_SENSOR_FIELDS; f += 1) {
+        for (size_t slot = 1; addr[f] != 0 && slot < pBuf->num_sensors; slot += 1) {
+            if (pBuf->addr[slot] == addr[f] && pBuf->temp[slot] != UNDEFINED_TEMP) {
+                history_add(f, pBuf->temp[slot], pBuf->timestamp_us);
+                any = true;
+            }
+        }
+    }
+    return any;
+}
+
+
+void sensor_task(void *pParams) {
+    // Triple buffers: the UI task keeps using the last set it received, without
+    // copying it, until it receives the next. So while the sensor task fills one
+    // buffer, the one before may be waiting in the queue and the one before that
+    // may still be in use by the UI.
+    //
+    static struct temp_data_t buffers[3];
+    int buf_index = 0;
+
+    struct temp_data_t *pBuf = &buffers[0];
+    struct temp_data_t *pLast = NULL;
+    int cycles_since_full_read = 0;
+    bool full_read_due = true;
 
     // dummy first sensor readings to simplify UI
     //
-    pTempData_A->addr[0] = 0;
-    pTempData_A->temp[0] = UNDEFINED_TEMP;
-    pTempData_B->addr[0] = 0;
-    pTempData_B->temp[0] = UNDEFINED_TEMP;
+    for (int i = 0; i < 3; i += 1) {
+        buffers[i].addr[0] = 0;
+        buffers[i].temp[0] = UNDEFINED_TEMP;
+    }
 
     // continuously scan bus and send readings to queue
     //
     for(;;) {
-        // scan bus for sensors
-        //
-        if (ds18x20_scan_devices(ONEWIRE_GPIO, pBuf->addr + 1, MAX_TEMP_SENSORS, &(pBuf->num_sensors)) == ESP_OK) {
-            if (pBuf->num_sensors > MAX_TEMP_SENSORS) {
-                pBuf->num_sensors = MAX_TEMP_SENSORS;
-            }
-            // read sensors, skip dummy
-            //
-            if (ds18x20_measure_and_read_multi(ONEWIRE_GPIO,
-                                               pBuf->addr + 1,
-                                               pBuf->num_sensors,
-                                               pBuf->temp + 1)
-            != ESP_OK) {
-                // couldn't read sensors
-                //
-                pBuf->num_sensors = 0;
-                vTaskDelay(pdMS_TO_TICKS(750));
+        esp_err_t err;
+
+        lowpower_bus_acquire();
+
+        if (SENSOR_POLL_MODE == SENSOR_POLL_ALARM) {
+            portENTER_CRITICAL(&field_lock);
+            if (thresholds_changed) {
+                thresholds_changed = false;
+                full_read_due = true;
             }
+            portEXIT_CRITICAL(&field_lock);
 
+            if (full_read_due || cycles_since_full_read >= SENSOR_FULL_READ_CYCLES) {
+                err = read_all_and_set_alarms(pBuf, pLast);
+                cycles_since_full_read = 0;
+                full_read_due = false;
+            } else {
+                err = read_alarmed(pBuf, pLast, &full_read_due);
+                cycles_since_full_read += 1;
+            }
+        } else if (SENSOR_POLL_MODE == SENSOR_POLL_ROLE) {
+            if (full_read_due || cycles_since_full_read >= SENSOR_FULL_READ_CYCLES) {
+                err = read_all(pBuf, pLast);
+                memset(cycles_since_read, 0, sizeof(cycles_since_read));
+                cycles_since_full_read = 0;
+                full_read_due = false;
+            } else {
+                err = read_scheduled(pBuf, pLast);
+                cycles_since_full_read += 1;
+            }
         } else {
-            // couldn't scan bus
+            err = read_all(pBuf, pLast);
+        }
+        lowpower_bus_release();
+
+        if (err != ESP_OK) {
+            // couldn't scan bus or read sensors
             //
             pBuf->num_sensors = 0;
+            full_read_due = true;
+            pLast = NULL;           // verify the next readings
             vTaskDelay(pdMS_TO_TICKS(750));
         }
 
         // send buffer pointer to queue
         //
         pBuf->num_sensors += 1; // count dummy
+        pBuf->timestamp_us = esp_timer_get_time();
+        bool valid = record_history(pBuf);
+        telemetry_send_temps(pBuf);
+        if (valid) {
+            failsafe_feed(FAILSAFE_SENSOR);     // only readings the control loop can use count
+        }
         if (xQueueSend(temperature_queue, (void *)&pBuf, 0) == pdTRUE) {
-            // successful send - flip buffers
+            // successful send - move on to the next buffer
             //
-            if (pBuf == pTempData_A) {
-                pBuf = pTempData_B;
-            } else {
-                pBuf = pTempData_A;
-            }
+            pLast = pBuf;
+            buf_index = (buf_index + 1) % 3;
+            pBuf = &buffers[buf_index];
         } else {
-            ESP_LOGW(TAG, "temp data queue full");
+            BINLOG_W("temp data queue full");
+            metrics_count(METRIC_TEMP_QUEUE_FULL);
+            full_read_due = true;   // pLast is out of date
+            pLast = NULL;
         }
         vTaskDelay(pdMS_TO_TICKS(250));
+        lowpower_count_wakeup(LP_SOURCE_SENSOR);
     }
 }
-
@@ -4,3 +4,4 @@
 extern QueueHandle_t temperature_queue;
 
 void sensor_task (void *pParams);
+void sensor_set_field(int field, ds18x20_addr_t addr, float threshold);
@@ -0,0 +1,271 @@
+#include <string.h>         // for memcpy()
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <driver/uart.h>
+#include <esp_timer.h>
+
+#include "defines.h"
+#include "types.h"
+#include "metrics.h"
+#include "energy.h"
+#include "history.h"
+#include "mqtt.h"
+#include "telemetry.h"
+
+// A binary stream of the readings, power state changes, set point changes,
+// metrics, energy accounting and temperature statistics, on a UART of its own. Each message is
+//
+//  type(1) seq(1) time_ms(4) body... crc(2)
+//
+// little-endian, with a CRC-16/CCITT-FALSE of everything before it. The message
+// is COBS encoded, so that it contains no zero bytes, and followed by a zero
+// byte. The sequence number counts every message, so the host can tell when
+// some have been lost. The bodies are:
+//
+//  TELEMETRY_TEMP_DATA     num(1) num * { addr(8) temp(2) }    temp in 1/16 C, or -32768 if undefined
+//  TELEMETRY_POWER_STATE   fridge(1) from(1) to(1)             see enum power_state_t
+//  TELEMETRY_SETPOINT      field(1) value(2)                   eg. F1_SET, in 1/10 C or UNDEFINED_TEMP
+//  TELEMETRY_METRICS       NUM_METRICS * { count(4) min(4) p99(4) max(4) }, NUM_METRIC_COUNTERS * { count(4) }
+//  TELEMETRY_ENERGY        fridge(1) NUM_ENERGY_WINDOWS * { struct energy_stats_t }
+//  TELEMETRY_HISTORY       field(1) NUM_HISTORY_WINDOWS * { min(2) max(2) mean(2) above_s(4) below_s(4) period_s(4) }
+//                                                              temps as for TELEMETRY_TEMP_DATA
+//
+// Messages are only copied into the UART driver's buffer, and are dropped
+// (and counted) if there isn't room, so sending never waits for the UART.
+// With MQTT_ENABLE the same frames are also published over WiFi (see mqtt.c).
+
+#define HEADER_LEN      6
+#define TEMP_BODY       (1 + MAX_TEMP_SENSORS * 10)
+#define METRICS_BODY    (NUM_METRICS * 16 + NUM_METRIC_COUNTERS * 4)
+#define MAX_BODY        ((TEMP_BODY > METRICS_BODY) ? TEMP_BODY : METRICS_BODY)
+#define MAX_MSG         (HEADER_LEN + MAX_BODY + 2)
+#define MAX_FRAME       (MAX_MSG + MAX_MSG / 254 + 2)       // COBS overhead and the delimiter
+
+_Static_assert(1 + NUM_ENERGY_WINDOWS * sizeof(struct energy_stats_t) <= MAX_BODY, "energy doesn't fit in a message");
+_Static_assert(1 + NUM_HISTORY_WINDOWS * 18 <= MAX_BODY, "history doesn't fit in a message");
+
+static const uint16_t crc_table[16] = {    // CRC-16/CCITT-FALSE, a nibble at a time
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+static SemaphoreHandle_t telemetry_lock;
+static StaticSemaphore_t telemetry_lock_buf;
+static esp_timer_handle_t metrics_timer;
+static uint8_t seq;
+
+
+static uint16_t crc16(const uint8_t *p, size_t len) {
+    uint16_t crc = 0xffff;
+    while (len--) {
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (*p >> 4)];
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (*p & 0x0f)];
+        p += 1;
+    }
+    return crc;
+}
+
+
+/// @brief COBS encodes a message and adds the zero delimiter.
+/// @param in the message
+/// @param len the length of the message
+/// @param out where to store the frame (at least MAX_FRAME bytes)
+/// @return the length of the frame
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t code_pos = 0;
+    size_t pos = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i += 1) {
+        if (in[i] != 0) {
+            out[pos++] = in[i];
+            code += 1;
+        }
+        if (in[i] == 0 || code == 0xff) {
+            out[code_pos] = code;
+            code_pos = pos++;
+            code = 1;
+        }
+    }
+    out[code_pos] = code;
+    out[pos++] = 0;
+    return pos;
+}
+
+
+/// @brief Frames a message and hands it to the UART driver.
+/// @param type the message type
+/// @param body the body of the message
+/// @param len the length of the body
+static void send(enum telemetry_msg_t type, const uint8_t *body, size_t len) {
+    uint8_t msg[MAX_MSG];
+    uint8_t frame[MAX_FRAME];
+    uint32_t time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    size_t free_space;
+
+    if (telemetry_lock == NULL) {
+        return;                             // not initialised yet
+    }
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+
+    msg[0] = type;
+    msg[1] = seq++;
+    memcpy(msg + 2, &time_ms, 4);           // the ESP32 is little-endian, as is the stream
+    memcpy(msg + HEADER_LEN, body, len);
+    uint16_t crc = crc16(msg, HEADER_LEN + len);
+    msg[HEADER_LEN + len] = crc & 0xff;
+    msg[HEADER_LEN + len + 1] = crc >> 8;
+    size_t n = cobs_encode(msg, HEADER_LEN + len + 2, frame);
+#if MQTT_ENABLE
+    mqtt_queue_frame(frame, n);
+#endif
+
+    if (uart_get_tx_buffer_free_size(TELEMETRY_UART, &free_space) == ESP_OK && free_space >= n) {
+        uart_write_bytes(TELEMETRY_UART, frame, n);
+    } else {
+        metrics_count(METRIC_TELEMETRY_DROPPED);
+    }
+    xSemaphoreGive(telemetry_lock);
+}
+
+
+/// @brief Converts a temperature to the 1/16 C of the stream.
+/// @param temp the temperature, or UNDEFINED_TEMP
+/// @return the temperature in 1/16 C, or -32768 if undefined
+static int16_t stream_temp(float temp) {
+    if (temp == UNDEFINED_TEMP) {
+        return INT16_MIN;
+    }
+    return (int16_t)(temp * 16);        // exact, at the sensors' resolution
+}
+
+
+/// @brief Sends a set of sensor readings.
+/// @param pTemp the readings (the dummy first one isn't sent)
+void telemetry_send_temps(const struct temp_data_t *pTemp) {
+    uint8_t body[MAX_BODY];
+    size_t len = 1;
+
+    for (size_t i = 1; i < pTemp->num_sensors && i <= MAX_TEMP_SENSORS; i += 1) {
+        int16_t temp = stream_temp(pTemp->temp[i]);
+        memcpy(body + len, &pTemp->addr[i], 8);
+        memcpy(body + len + 8, &temp, 2);
+        len += 10;
+    }
+    body[0] = (len - 1) / 10;
+    send(TELEMETRY_TEMP_DATA, body, len);
+}
+
+
+/// @brief Sends a change in the power state of a fridge.
+/// @param fridge_num the index of the fridge (0 or 1)
+/// @param from the previous state
+/// @param to the new state
+void telemetry_send_power_state(int fridge_num, enum power_state_t from, enum power_state_t to) {
+    uint8_t body[3] = { fridge_num, from, to };
+    send(TELEMETRY_POWER_STATE, body, sizeof(body));
+}
+
+
+/// @brief Sends a change to one of the settings.
+/// @param field the setting, eg. F1_SET
+/// @param value the new value (internal integer representation)
+void telemetry_send_setpoint(int field, int value) {
+    int16_t v = value;
+    uint8_t body[3] = { field };
+    memcpy(body + 1, &v, 2);
+    send(TELEMETRY_SETPOINT, body, sizeof(body));
+}
+
+
+/// @brief Sends the metrics summaries.
+static void send_metrics(void) {
+    uint8_t body[MAX_BODY];
+    struct metric_summary_t s;
+    size_t len = 0;
+
+    for (int m = 0; m < NUM_METRICS; m += 1) {
+        metrics_get(m, &s);
+        memcpy(body + len, &s, 16);         // four uint32_t
+        len += 16;
+    }
+    for (int c = 0; c < NUM_METRIC_COUNTERS; c += 1) {
+        uint32_t count = metrics_get_count(c);
+        memcpy(body + len, &count, 4);
+        len += 4;
+    }
+    send(TELEMETRY_METRICS, body, len);
+}
+
+
+/// @brief Sends the energy accounting windows, one message for each fridge.
+static void send_energy(void) {
+    uint8_t body[MAX_BODY];
+    struct energy_stats_t s;
+
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        size_t len = 0;
+        body[len++] = fridge_num;
+        for (int w = 0; w < NUM_ENERGY_WINDOWS; w += 1) {
+            energy_get(fridge_num, w, &s);
+            memcpy(body + len, &s, sizeof(s));
+            len += sizeof(s);
+        }
+        send(TELEMETRY_ENERGY, body, len);
+    }
+}
+
+
+/// @brief Sends the temperature statistics, one message for each sensor field.
+static void send_history(void) {
+    uint8_t body[MAX_BODY];
+    struct history_stats_t s;
+
+    for (int field = 0; field < MAX_SENSOR_FIELDS; field += 1) {
+        size_t len = 0;
+        body[len++] = field;
+        for (int w = 0; w < NUM_HISTORY_WINDOWS; w += 1) {
+            history_get(field, w, &s);
+            int16_t temps[3] = { stream_temp(s.min), stream_temp(s.max), stream_temp(s.mean) };
+            uint32_t times[3] = { s.above_s, s.below_s, s.period_s };
+            memcpy(body + len, temps, sizeof(temps));
+            memcpy(body + len + 6, times, sizeof(times));
+            len += 18;
+        }
+        send(TELEMETRY_HISTORY, body, len);
+    }
+}
+
+
+/// @brief Sends the periodic messages: called every TELEMETRY_METRICS_MS.
+static void send_periodic(void *arg) {
+    send_metrics();
+    send_energy();
+    send_history();
+}
+
+
+/// @brief Sets up the telemetry UART (transmit only) and the metrics timer.
+void telemetry_init(void) {
+    const uart_config_t uart_config = {
+        .baud_rate = TELEMETRY_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT
+    };
+    const esp_timer_create_args_t timer_args = {
+        .callback = send_periodic,
+        .name = "telemetry"
+    };
+
+    ESP_ERROR_CHECK(uart_driver_install(TELEMETRY_UART, 256, TELEMETRY_TX_BUF_SIZE, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(TELEMETRY_UART, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(TELEMETRY_UART, TELEMETRY_TX_GPIO, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    uart_write_bytes(TELEMETRY_UART, "", 1);     // a delimiter, to separate the first message from any noise
+
+    telemetry_lock = xSemaphoreCreateMutexStatic(&telemetry_lock_buf);
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &metrics_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(metrics_timer, TELEMETRY_METRICS_MS * 1000ull));
+}
@@ -0,0 +1,20 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "types.h"
+
+enum telemetry_msg_t {                      // message types, also used by tools/telemetry_decode.py
+    TELEMETRY_TEMP_DATA = 1,
+    TELEMETRY_POWER_STATE,
+    TELEMETRY_SETPOINT,
+    TELEMETRY_METRICS,
+    TELEMETRY_ENERGY,
+    TELEMETRY_HISTORY
+};
+
+void telemetry_init(void);
+void telemetry_send_temps(const struct temp_data_t *pTemp);
+void telemetry_send_power_state(int fridge_num, enum power_state_t from, enum power_state_t to);
+void telemetry_send_setpoint(int field, int value);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>         // for strncpy()
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include "sdkconfig.h"
+
+#include "defines.h"
+#include "binlog.h"
+#include "trace.h"
+
+#if TRACE_ENABLE
+
+// A ring of the most recent TRACE_RING_SIZE events, which the console can send
+// to the host (key 't') for tools/trace2json.py to turn into a Chrome trace.
+//
+// The stream is a header, a table of task names and then the records, all
+// little-endian:
+//
+//  "BTRC" version(1) num_tasks(1) num_records(2)
+//  num_tasks * { id(1) name(16) }
+//  num_records * { time_us(4) type(1) a(1) b(2) }
+//
+// Events are recorded from the scheduler and from ISRs, so everything they
+// touch is in IRAM/DRAM and they take a spinlock rather than a mutex.
+
+#define TRACE_VERSION       1
+#define TRACE_NAME_LEN      16
+#define TRACE_NO_TASK       0xff
+
+struct trace_record_t {
+    uint32_t time_us;                       // low 32 bits of esp_timer_get_time()
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+};
+
+static DRAM_ATTR portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+static DRAM_ATTR struct trace_record_t ring[TRACE_RING_SIZE];
+static DRAM_ATTR uint32_t head;             // total number of records written
+static DRAM_ATTR volatile bool paused;      // while the ring is being streamed
+static DRAM_ATTR void *task[TRACE_MAX_TASKS];
+static DRAM_ATTR int num_tasks;
+static DRAM_ATTR void *queue[TRACE_MAX_QUEUES];
+
+
+/// @brief Adds a record to the ring, overwriting the oldest one if it's full.
+/// @param type the type of event
+/// @param a the first argument (see enum trace_event_t)
+/// @param b the second argument
+void IRAM_ATTR trace_event(enum trace_event_t type, uint8_t a, uint16_t b) {
+    if (paused) {
+        return;
+    }
+
+    // the time is read under the lock, so that the records are in time order
+    // even when the other core or an ISR records one at the same moment
+    portENTER_CRITICAL_SAFE(&trace_lock);
+    struct trace_record_t *r = &ring[head % TRACE_RING_SIZE];
+    r->time_us = (uint32_t)esp_timer_get_time();
+    r->type = type;
+    r->a = a;
+    r->b = b;
+    head += 1;
+    portEXIT_CRITICAL_SAFE(&trace_lock);
+}
+
+
+/// @brief Records a context switch: called by the scheduler (see trace_hooks.h).
+void IRAM_ATTR trace_task_switched_in(void) {
+    void *current = xTaskGetCurrentTaskHandle();
+    int id;
+
+    // both cores' schedulers can be adding a task at once, so the table is only
+    // touched under the lock
+    portENTER_CRITICAL_SAFE(&trace_lock);
+    for (id = 0; id < num_tasks && task[id] != current; id += 1) {
+    }
+    if (id == num_tasks) {
+        if (num_tasks < TRACE_MAX_TASKS) {
+            task[id] = current;
+            num_tasks += 1;
+        } else {
+            id = TRACE_NO_TASK;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&trace_lock);
+    trace_event(TRACE_TASK_SWITCH, xPortGetCoreID(), id);
+}
+
+
+/// @brief Records an item being sent to or received from one of the registered queues.
+/// @param q the queue
+/// @param op 0 for a send, 1 for a receive
+void IRAM_ATTR trace_queue_op(void *q, int op) {
+    for (int id = 0; id < TRACE_MAX_QUEUES; id += 1) {
+        if (queue[id] == q && q != NULL) {
+            trace_event(op ? TRACE_QUEUE_RECEIVE : TRACE_QUEUE_SEND, id, 0);
+            return;
+        }
+    }
+}
+
+
+/// @brief Adds a queue to those whose sends and receives are recorded.
+/// @param q the queue
+/// @param id its name in the trace, eg. TRACE_QUEUE_TEMPERATURE
+void trace_register_queue(void *q, enum trace_queue_t id) {
+    queue[id] = q;
+}
+
+
+/// @brief Sends the ring to the console UART, oldest record first.
+///
+/// Recording is paused meanwhile, so the stream is a consistent snapshot.
+void trace_stream(void) {
+    uint8_t header[8] = { 'B', 'T', 'R', 'C', TRACE_VERSION };
+    char name[TRACE_NAME_LEN];
+
+#if BINLOG_ENABLE
+    binlog_pause();                         // keep log records out of the stream
+#endif
+    paused = true;
+    portENTER_CRITICAL(&trace_lock);        // wait for any record in progress
+    uint32_t count = (head < TRACE_RING_SIZE) ? head : TRACE_RING_SIZE;
+    uint32_t first = head - count;
+    int tasks = num_tasks;
+    portEXIT_CRITICAL(&trace_lock);
+
+    header[5] = tasks;
+    header[6] = count & 0xff;
+    header[7] = count >> 8;
+    uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, header, sizeof(header));
+
+    for (int id = 0; id < tasks; id += 1) {
+        uint8_t id_byte = id;
+        strncpy(name, pcTaskGetName(task[id]), sizeof(name));
+        uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &id_byte, 1);
+        uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, name, sizeof(name));
+    }
+
+    // the ESP32 is little-endian, as is the stream, so the records go as they are
+    for (uint32_t i = first; i != head; i += 1) {
+        uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, &ring[i % TRACE_RING_SIZE], sizeof(struct trace_record_t));
+    }
+    uart_wait_tx_done(CONFIG_ESP_CONSOLE_UART_NUM, portMAX_DELAY);
+    paused = false;
+#if BINLOG_ENABLE
+    binlog_resume();
+#endif
+}
+
+#endif // TRACE_ENABLE
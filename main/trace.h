@@ -0,0 +1,48 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "defines.h"
+
+enum trace_event_t {                        // record types, also used by tools/trace2json.py
+    TRACE_TASK_SWITCH,                      // a = core, b = task id
+    TRACE_QUEUE_SEND,                       // a = queue id
+    TRACE_QUEUE_RECEIVE,                    // a = queue id
+    TRACE_ONEWIRE_BEGIN,                    // a = transaction, eg. TRACE_ONEWIRE_READ
+    TRACE_ONEWIRE_END,                      // a = transaction, b = esp_err_t
+    TRACE_I2C_WRITE,                        // a = data byte, b = esp_err_t
+    TRACE_RELAY                             // a = output, eg. TRACE_F1_RELAY, b = level
+};
+
+enum trace_queue_t {
+    TRACE_QUEUE_TEMPERATURE,
+    TRACE_QUEUE_ENCODER,
+    TRACE_MAX_QUEUES
+};
+
+enum trace_onewire_t {
+    TRACE_ONEWIRE_SCAN,
+    TRACE_ONEWIRE_CONVERT,
+    TRACE_ONEWIRE_READ,
+    TRACE_ONEWIRE_ALARM_SEARCH,
+    TRACE_ONEWIRE_SET_ALARM
+};
+
+enum trace_output_t {
+    TRACE_F1_RELAY,
+    TRACE_F2_RELAY,
+    TRACE_F1_SSR,
+    TRACE_F2_SSR
+};
+
+#if TRACE_ENABLE
+#define TRACE(type, a, b)   trace_event(type, a, b)
+#else
+#define TRACE(type, a, b)
+#endif
+
+void trace_event(enum trace_event_t type, uint8_t a, uint16_t b);
+void trace_register_queue(void *queue, enum trace_queue_t id);
+void trace_stream(void);
+
+#endif // TRACE_H
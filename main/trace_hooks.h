@@ -0,0 +1,22 @@
+#ifndef TRACE_HOOKS_H
+#define TRACE_HOOKS_H
+
+// FreeRTOS trace hooks, force-included into every C file of the build when
+// TRACE_ENABLE is set in the top level CMakeLists.txt, so that the kernel is
+// compiled with them. This is included before anything else, so it can't use
+// any FreeRTOS types.
+
+#ifndef __ASSEMBLER__
+
+void trace_task_switched_in(void);
+void trace_queue_op(void *queue, int op);
+
+#define traceTASK_SWITCHED_IN()                 trace_task_switched_in()
+#define traceQUEUE_SEND(pxQueue)                trace_queue_op(pxQueue, 0)
+#define traceQUEUE_SEND_FROM_ISR(pxQueue)       trace_queue_op(pxQueue, 0)
+#define traceQUEUE_RECEIVE(pxQueue)             trace_queue_op(pxQueue, 1)
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue)    trace_queue_op(pxQueue, 1)
+
+#endif // __ASSEMBLER__
+
+#endif // TRACE_HOOKS_H
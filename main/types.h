@@ -8,6 +8,7 @@ struct temp_data_t {
     size_t num_sensors;
     ds18x20_addr_t addr[MAX_TEMP_SENSORS];  // underlying type is uint64_t
     float temp[MAX_TEMP_SENSORS];
+    int64_t timestamp_us;                   // esp_timer time at which the readings were sent
 };
 
 #define UNDEFINED_TEMP -999                 // displayed as " off"
@@ -21,6 +22,37 @@ enum power_state_t {
     PWR_HEATING                             // no heating overrun required
 };
 
+// indexes of the sensor fields: beer, air and heat for each fridge in turn
+#define F1_SENSOR_BEER              0
+#define F1_SENSOR_AIR               1
+#define F1_SENSOR_HEAT              2
+#define F2_SENSOR_BEER              3
+#define F2_SENSOR_AIR               4
+#define F2_SENSOR_HEAT              5
+#define SENSOR_FIELDS_PER_FRIDGE    3
+
+// indexes of the settings fields
+#define F1_SET                      0
+#define F2_SET                      1
+#define F1_COOL                     2
+#define F2_COOL                     3
+#define F1_HEAT                     4
+#define F2_HEAT                     5
+#define NUM_SET_FIELDS              6
+
+enum profile_step_type_t {                  // the kinds of fermentation profile step
+    PROFILE_HOLD,                           // hold the temperature
+    PROFILE_RAMP,                           // change steadily from the previous step's temperature
+    PROFILE_REST,                           // a diacetyl rest: a hold, usually a few degrees up
+    NUM_PROFILE_STEP_TYPES
+};
+
+struct profile_step_t {                     // used by `profile` and `flash` modules, stored as is in NVS
+    uint16_t type : 2;                      // enum profile_step_type_t
+    uint16_t temp : 14;                     // the set point at the end of the step, in 1/10 C
+    uint16_t minutes;                       // the length of the step, up to 45 days
+};
+
 struct sensor_field_t {                     // used by `ui_task` and `flash` modules
     const char title[5];
     const int title_x;
@@ -4,7 +4,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>                 // memset()
+#include <math.h>                   // lroundf()
 #include "esp_log.h"
+#include "esp_timer.h"              // esp_timer_get_time()
 
 #include <ds18x20.h>                // oneWire temperature sensor
 #include <encoder.h>                // rotary encoder
@@ -17,6 +19,19 @@
 #include "sensor_task.h"
 #include "power.h"
 #include "flash.h"
+#include "deadline.h"
+#include "lowpower.h"
+#include "encoder_pcnt.h"
+#include "metrics.h"
+#include "trace.h"
+#include "binlog.h"
+#include "telemetry.h"
+#include "energy.h"
+#include "load.h"
+#include "history.h"
+#include "jitter.h"
+#include "failsafe.h"
+#include "profile.h"
 
 
 #define COL_1   0                   // dislay column positions
@@ -42,7 +57,11 @@ enum ui_mode_t {
     UI_MODE_SENSOR_3,
     UI_MODE_SENSOR_4,
     UI_MODE_SENSOR_5,
-    UI_MODE_SENSOR_6
+    UI_MODE_SENSOR_6,
+    UI_MODE_ENERGY,
+    UI_MODE_STATS,
+    UI_MODE_GRAPH,
+    UI_MODE_PROFILE
 };
 
 enum ui_event_t {
@@ -55,6 +74,14 @@ enum ui_event_t {
     UI_EVENT_NEW_TEMP_DATA
 };
 
+enum ui_timer_t {                   // timers in the deadline scheduler
+    UI_TIMER_BLINK,
+    UI_TIMER_TIMEOUT,
+    UI_TIMER_SLEEP,
+    UI_TIMER_CONTROL,
+    UI_TIMER_JITTER                 // the control probe in JITTER_ENABLE builds
+};
+
 struct set_field_t {
     const char title[6];
     const int title_x;
@@ -83,7 +110,11 @@ static const enum ui_mode_t next_state_btn_press[] = {
     UI_MODE_SENSOR_4,               // sensor_3 -> sensor_4
     UI_MODE_SENSOR_5,               // sensor_4 -> sensor_5
     UI_MODE_SENSOR_6,               // sensor_1 -> sensor_6
-    UI_MODE_SENSOR_1                // sensor_6 -> sensor_1
+    UI_MODE_SENSOR_1,               // sensor_6 -> sensor_1
+    UI_MODE_STATUS,                 // energy -> status
+    UI_MODE_STATUS,                 // stats -> status
+    UI_MODE_STATUS,                 // graph -> status
+    UI_MODE_STATUS                  // profile -> status
 };
 
 static const enum ui_mode_t next_state_long_press[] = {
@@ -101,12 +132,17 @@ static const enum ui_mode_t next_state_long_press[] = {
     UI_MODE_STATUS,                 // sensor_3 -> status
     UI_MODE_STATUS,                 // sensor_4 -> status
     UI_MODE_STATUS,                 // sensor_5 -> status
-    UI_MODE_STATUS                  // sensor_6 -> status
+    UI_MODE_STATUS,                 // sensor_6 -> status
+    UI_MODE_STATUS,                 // energy -> status
+    UI_MODE_STATUS,                 // stats -> status
+    UI_MODE_STATUS,                 // graph -> status
+    UI_MODE_STATUS                  // profile -> status
 };
 
 static const enum ui_mode_t next_state_timeout[] = {
     UI_MODE_STATUS,                 // splash -> status
     UI_MODE_SLEEP,                  // sleep -> sleep
+    UI_MODE_STATUS,                 // status -> status
     UI_MODE_STATUS,                 // set_1 -> status
     UI_MODE_STATUS,                 // set_2 -> status
     UI_MODE_STATUS,                 // set_3 -> status
@@ -118,7 +154,11 @@ static const enum ui_mode_t next_state_timeout[] = {
     UI_MODE_STATUS,                 // sensor_3 -> status
     UI_MODE_STATUS,                 // sensor_4 -> status
     UI_MODE_STATUS,                 // sensor_5 -> status
-    UI_MODE_STATUS                  // sensor_6 -> status
+    UI_MODE_STATUS,                 // sensor_6 -> status
+    UI_MODE_STATUS,                 // energy -> status
+    UI_MODE_STATUS,                 // stats -> status
+    UI_MODE_STATUS,                 // graph -> status
+    UI_MODE_STATUS                  // profile -> status
 };
 
 // screen positions of the temperature sensor fields
@@ -129,12 +169,7 @@ static const enum ui_mode_t next_state_timeout[] = {
 // 1    beer 12.3  beer 12.3
 // 2    air  10.0  air  10.0
 // 3    heat 12.3  heat 12.3
-#define F1_SENSOR_BEER  0
-#define F1_SENSOR_AIR   1
-#define F1_SENSOR_HEAT  2
-#define F2_SENSOR_BEER  3
-#define F2_SENSOR_AIR   4
-#define F2_SENSOR_HEAT  5
+// (the field indexes F1_SENSOR_BEER etc. are defined in types.h)
 static struct sensor_field_t sensor_field[] = {
     //  title[5],   title_x,    title_y,    data_x, data_y, addr,   value
     {   "beer",     COL_1,      1,          COL_2,  1,      0ull,   UNDEFINED_TEMP },   // F1_SENSOR_BEER
@@ -153,12 +188,7 @@ static struct sensor_field_t sensor_field[] = {
 // 1    set	 12.3  set  12.3
 // 2    cool- 4.5  cool- off
 // 3    heat+ off  heat+ 2.0
-#define F1_SET  0
-#define F2_SET  1
-#define F1_COOL 2
-#define F2_COOL 3
-#define F1_HEAT 4
-#define F2_HEAT 5
+// (the field indexes F1_SET etc. are defined in types.h)
 static struct set_field_t set_field[] = {
     //  title[6],   title_x,    title_y,    data_x, data_y, value
     {   "set",      COL_1,      1,          COL_2,  1,      UNDEFINED_TEMP },   // F1_SET
@@ -169,6 +199,56 @@ static struct set_field_t set_field[] = {
     {   "heat+",    COL_3,      3,          COL_4,  3,      UNDEFINED_TEMP }    // F2_HEAT
 };
 
+// turning the knob from the status screen steps through the trend graph, the
+// energy screen and the temperature statistics screen, which show one window
+// at a time, and then the fermentation profiles
+//
+// the energy screen covers the compressor and then the power use
+//
+//      01234567890123456789
+// 0    COMPRESSOR  last 1h
+// 1    start  12  start   3
+// 2    on    45%  on    12%
+// 3    limit   0  limit   0
+//
+// 0    POWER       last 24h
+// 1    heat   3%  heat   0%
+// 2    wait   1%  wait   2%
+// 3    kWh   1.2  kWh   0.4
+//
+// the statistics screen covers each fridge in turn, the temperatures and then
+// the time spent above and below the control thresholds (the set point for the
+// beer)
+//
+//      01234567890123456789
+// 0    F1 24h  lo   hi  avg
+// 1    beer 17.9 18.6 18.2
+// 2    air   9.5 19.0 14.1
+// 3    heat   --   --   --
+//
+// 0    F1 24h     >set <set
+// 1    beer       12%  80%
+//
+// the trend graph shows the mean beer temperature of each fridge over the 5
+// minute history, as bars in four user-defined characters, scaled between the
+// lowest and highest temperatures shown
+//
+// 0    BEER 4h      lo   hi
+// 1    F1 ####    17.9 18.6
+// 2    F2 ####    12.0 12.4
+//
+// the profile screen shows the step each fridge's profile is on, and the time
+// left in it (or off, or done once it has finished)
+//
+// 0    PROFILE  step   left
+// 1    F1 ramp   2/5  3d04h
+// 2    F2 hold   1/5    off
+#define ENERGY_VIEWS    (2 * NUM_ENERGY_WINDOWS)
+#define STATS_VIEWS     (2 * 2 * NUM_HISTORY_WINDOWS)
+#define GRAPH_GLYPHS    (LCD_GLYPHS / 2)            // characters in each fridge's graph
+#define GRAPH_COLUMNS   (GRAPH_GLYPHS * 5)          // bars in each fridge's graph, oldest on the left
+static const char *window_name[] = { "1h", "24h", "7d" };  // of the ENERGY_ and HISTORY_ windows
+
 static const char power_state_indicator[] = {
     ' ',    // pwr_off
     '-',    // pwr_cool_requested
@@ -181,22 +261,50 @@ static const char power_state_indicator[] = {
 static const int num_sensor_fields = sizeof(sensor_field) / sizeof(struct sensor_field_t);
 static const int num_set_fields = sizeof(set_field) / sizeof(struct set_field_t);
 static QueueHandle_t encoder_event_queue;
+static StaticQueue_t encoder_event_queue_buf;
+static uint8_t encoder_event_queue_storage[RE_EVENT_QUEUE_SIZE * sizeof(rotary_encoder_event_t)];
 static rotary_encoder_t re;
 static char buf[10];
 static enum ui_mode_t mode;
 static ds18x20_addr_t addr;
-static int timeout_count;
-static struct temp_data_t temp_data;
+static QueueSetHandle_t ui_queue_set;
+static bool temp_pending;           // coalesce_changes() took the temperature queue's entry from the set
+static const struct temp_data_t no_temp_data;
+static const struct temp_data_t *pTemp_data = &no_temp_data;   // the latest readings, owned by the sensor task
 static int blink_x;
 static int blink_y;
 static bool blink_enabled;
+static bool blink_hidden;
 static bool sensor_addresses_changed = false;
+static int64_t sample_us;           // when the readings not yet acted on were taken, or 0
+static int energy_view;             // which window (and page) the energy screen shows
+static int stats_view;              // which fridge, window (and page) the statistics screen shows
+static int64_t graph_end[2];        // the history bucket each fridge's graph was drawn up to
+static struct ui_state_t published; // the settings and readings as of the last event, for ui_get_state()
+static portMUX_TYPE published_lock = portMUX_INITIALIZER_UNLOCKED;
+#if JITTER_ENABLE
+static TickType_t jitter_due;       // when the control probe is next due
+#endif
 
 
 // function definitions
 // --------------------
 
 
+/// @brief Formats a number of tenths with one decimal place, like "%*.1f" but without floating point printf.
+/// @param buf Where to store the string.
+/// @param buflen Space available to store the string and terminating '\0'.
+/// @param width The minimum width, padded with spaces on the left.
+/// @param tenths The number in tenths, eg. -25 for -2.5.
+static void tenths_to_str(char *buf, size_t buflen, int width, long tenths) {
+    unsigned long magnitude = (tenths < 0) ? -tenths : tenths;
+    char digits[16];
+
+    snprintf(digits, sizeof(digits), "%s%lu.%lu", (tenths < 0) ? "-" : "", magnitude / 10, magnitude % 10);
+    snprintf(buf, buflen, "%*s", width, digits);
+}
+
+
 /// @brief Converts the internal integer representation of a temperature into a string. 
 /// @param buf Where to store the string.
 /// @param buflen Space available to store the string and terminating '\0'.
@@ -205,8 +313,30 @@ static void value_to_temp_str(char *buf, size_t buflen, int temp) {
     if (temp == UNDEFINED_TEMP) {
         snprintf(buf, buflen, " off");
     } else {
-        snprintf(buf, buflen, "%4.1f", temp / 10.0);
+        tenths_to_str(buf, buflen, 4, temp);
+    }
+}
+
+
+/// @brief Checks whether a settings field is a beer set point that its fridge's profile is driving.
+/// @param i the field, eg. F1_SET
+static bool set_by_profile(int i) {
+    struct profile_status_t p;
+
+    if (i != F1_SET && i != F2_SET) {
+        return false;
     }
+    profile_get_status(i - F1_SET, 0, &p);
+    return p.state == PROFILE_RUNNING;
+}
+
+
+/// @brief Draws a settings field's title, which is "prof" while a profile drives it.
+/// @param i the field, eg. F1_SET
+static void set_field_title_display(int i) {
+    snprintf(buf, sizeof(buf), "%-5s", set_by_profile(i) ? "prof" : set_field[i].title);
+    lcd_gotoxy(set_field[i].title_x, set_field[i].title_y);
+    lcd_puts(buf);
 }
 
 
@@ -218,17 +348,298 @@ static void status_display_sensor_temps(void) {
         if (sensor_field[i].temp == UNDEFINED_TEMP) {
             lcd_puts(" off");
         } else {
-            snprintf(buf, sizeof(buf), "%4.1f", sensor_field[i].temp);
+            tenths_to_str(buf, sizeof(buf), 4, lroundf(sensor_field[i].temp * 10));
             lcd_puts(buf);
         }
     }
 }
 
 
+/// @brief Shows one line of a fridge's column on the energy screen.
+/// @param x the column, COL_1 or COL_3
+/// @param y the row
+/// @param title the title, up to 5 characters
+/// @param data the value, up to 4 characters
+static void energy_display_field(int x, int y, const char *title, const char *data) {
+    char field[10];
+    snprintf(field, sizeof(field), "%-5s%4s", title, data);
+    lcd_gotoxy(x, y);
+    lcd_puts(field);
+}
+
+
+/// @brief Displays the energy screen for the current value of energy_view.
+static void energy_display(void) {
+    enum energy_window_t window = energy_view % NUM_ENERGY_WINDOWS;
+    bool compressor_page = (energy_view < NUM_ENERGY_WINDOWS);
+    char line[LCD_COLS + 1];
+    char data[3][8];
+
+    snprintf(line, sizeof(line), "%-12slast %-3s", compressor_page ? "COMPRESSOR" : "POWER", window_name[window]);
+    lcd_gotoxy(0, 0);
+    lcd_puts(line);
+
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        struct energy_stats_t s;
+        int x = (fridge_num == 0) ? COL_1 : COL_3;
+
+        energy_get(fridge_num, window, &s);
+        uint32_t period_s = (s.period_s > 0) ? s.period_s : 1;
+        if (compressor_page) {
+            snprintf(data[0], sizeof(data[0]), "%4u", (unsigned)(s.starts > 9999 ? 9999 : s.starts));
+            snprintf(data[1], sizeof(data[1]), "%3u%%", (unsigned)((uint64_t)s.compressor_s * 100 / period_s));
+            snprintf(data[2], sizeof(data[2]), "%4u", (unsigned)(s.forced_stops > 9999 ? 9999 : s.forced_stops));
+            energy_display_field(x, 1, "start", data[0]);
+            energy_display_field(x, 2, "on", data[1]);
+            energy_display_field(x, 3, "limit", data[2]);
+        } else {
+            snprintf(data[0], sizeof(data[0]), "%3u%%", (unsigned)((uint64_t)s.heater_s * 100 / period_s));
+            snprintf(data[1], sizeof(data[1]), "%3u%%", (unsigned)((uint64_t)s.blocked_s * 100 / period_s));
+            if (s.wh < 10000) {
+                tenths_to_str(data[2], sizeof(data[2]), 4, (s.wh + 50) / 100);
+            } else {
+                snprintf(data[2], sizeof(data[2]), "%4u", (unsigned)(s.wh / 1000));
+            }
+            energy_display_field(x, 1, "heat", data[0]);
+            energy_display_field(x, 2, "wait", data[1]);
+            energy_display_field(x, 3, "kWh", data[2]);
+        }
+    }
+}
+
+
+/// @brief Displays the statistics screen for the current value of stats_view.
+static void stats_display(void) {
+    int fridge_num = stats_view / (2 * NUM_HISTORY_WINDOWS);
+    enum history_window_t window = (stats_view / 2) % NUM_HISTORY_WINDOWS;
+    bool temps_page = (stats_view % 2 == 0);
+    char line[LCD_COLS + 1];
+    char data[3][8];
+
+    snprintf(line, sizeof(line), "F%d %-4s%s", fridge_num + 1, window_name[window], temps_page ? " lo   hi  avg" : "    >set <set");
+    lcd_gotoxy(0, 0);
+    lcd_puts(line);
+
+    for (int row = 0; row < SENSOR_FIELDS_PER_FRIDGE; row += 1) {
+        int field = fridge_num * SENSOR_FIELDS_PER_FRIDGE + row;
+        struct history_stats_t s;
+
+        history_get(field, window, &s);
+        if (temps_page) {
+            float value[3] = { s.min, s.max, s.mean };
+            for (int i = 0; i < 3; i += 1) {
+                if (value[i] == UNDEFINED_TEMP) {
+                    snprintf(data[i], sizeof(data[i]), "   --");
+                } else {
+                    tenths_to_str(data[i], sizeof(data[i]), 5, lroundf(value[i] * 10));
+                }
+            }
+        } else {
+            uint32_t period_s = (s.period_s > 0) ? s.period_s : 1;
+            snprintf(data[0], sizeof(data[0]), " ");
+            snprintf(data[1], sizeof(data[1]), "%4u%%", (unsigned)((uint64_t)s.above_s * 100 / period_s));
+            snprintf(data[2], sizeof(data[2]), "%4u%%", (unsigned)((uint64_t)s.below_s * 100 / period_s));
+        }
+        snprintf(line, sizeof(line), "%-5s%5s%5s%5s", sensor_field[field].title, data[0], data[1], data[2]);
+        lcd_gotoxy(0, row + 1);
+        lcd_puts(line);
+    }
+}
+
+
+/// @brief Draws a fridge's line of the trend graph.
+///
+/// Each bar covers the same history buckets from one time to the next, rather
+/// than a share of the last few hours, so that until a new bar starts only the
+/// newest one changes. Since lcd_set_glyph() passes on only the pixel rows that
+/// differ, a new bucket usually costs a few bytes of I2C, not four glyphs.
+///
+/// @param fridge_num the fridge
+/// @param end the number of the open 5 minute bucket, after the newest closed one
+static void graph_display_fridge(int fridge_num, int64_t end) {
+    int field = F1_SENSOR_BEER + fridge_num * SENSOR_FIELDS_PER_FRIDGE;
+    long bar[GRAPH_COLUMNS];        // mean temperature in tenths, or UNDEFINED_TEMP
+    long lo = 0;
+    long hi = 0;
+    bool defined = false;
+
+    // bar k covers the buckets n with n * GRAPH_COLUMNS / HISTORY_5M_BUCKETS == k
+    int64_t newest = (end - 1) * GRAPH_COLUMNS / HISTORY_5M_BUCKETS;
+    for (int col = 0; col < GRAPH_COLUMNS; col += 1) {
+        int64_t k = newest - (GRAPH_COLUMNS - 1) + col;
+        float sum = 0;
+        int count = 0;
+
+        bar[col] = UNDEFINED_TEMP;
+        if (end <= 0 || k < 0) {
+            continue;
+        }
+        int64_t from = (k * HISTORY_5M_BUCKETS + GRAPH_COLUMNS - 1) / GRAPH_COLUMNS;
+        int64_t to = ((k + 1) * HISTORY_5M_BUCKETS + GRAPH_COLUMNS - 1) / GRAPH_COLUMNS;
+        for (int64_t n = from; n < to && n < end; n += 1) {
+            struct history_bucket_t b;
+            if (history_get_bucket(field, HISTORY_TIER_5M, n, &b) && b.mean != UNDEFINED_TEMP) {
+                sum += b.mean;
+                count += 1;
+            }
+        }
+        if (count > 0) {
+            bar[col] = lroundf(sum * 10 / count);
+            lo = (!defined || bar[col] < lo) ? bar[col] : lo;
+            hi = (!defined || bar[col] > hi) ? bar[col] : hi;
+            defined = true;
+        }
+    }
+
+    // scale to at least UI_GRAPH_MIN_SPAN, so that noise doesn't fill the graph
+    if (hi - lo < UI_GRAPH_MIN_SPAN) {
+        lo = (lo + hi - UI_GRAPH_MIN_SPAN) / 2;
+        hi = lo + UI_GRAPH_MIN_SPAN;
+    }
+
+    // a bar is 1 to LCD_GLYPH_ROWS pixels high, so that the lowest still shows
+    uint8_t rows[GRAPH_GLYPHS][LCD_GLYPH_ROWS];
+    memset(rows, 0, sizeof(rows));
+    for (int col = 0; col < GRAPH_COLUMNS; col += 1) {
+        if (bar[col] != UNDEFINED_TEMP) {
+            int height = 1 + ((bar[col] - lo) * (LCD_GLYPH_ROWS - 1) + (hi - lo) / 2) / (hi - lo);
+            for (int row = LCD_GLYPH_ROWS - height; row < LCD_GLYPH_ROWS; row += 1) {
+                rows[col / 5][row] |= 0x10 >> (col % 5);
+            }
+        }
+    }
+    for (int g = 0; g < GRAPH_GLYPHS; g += 1) {
+        lcd_set_glyph(fridge_num * GRAPH_GLYPHS + g, rows[g]);
+    }
+
+    char chars[GRAPH_GLYPHS + 1];
+    char data[2][8];
+    char line[LCD_COLS + 1];
+    for (int g = 0; g < GRAPH_GLYPHS; g += 1) {
+        chars[g] = LCD_GLYPH_CHAR(fridge_num * GRAPH_GLYPHS + g);
+    }
+    chars[GRAPH_GLYPHS] = '\0';
+    if (defined) {
+        tenths_to_str(data[0], sizeof(data[0]), 5, lo);
+        tenths_to_str(data[1], sizeof(data[1]), 5, hi);
+    } else {
+        snprintf(data[0], sizeof(data[0]), "   --");
+        snprintf(data[1], sizeof(data[1]), "   --");
+    }
+    snprintf(line, sizeof(line), "F%d %s   %5s%5s", fridge_num + 1, chars, data[0], data[1]);
+    lcd_gotoxy(0, fridge_num + 1);
+    lcd_puts(line);
+}
+
+
+/// @brief Displays the trend graph, or updates it if a history bucket has closed since.
+/// @param force true to redraw both fridges' lines regardless
+static void graph_display(bool force) {
+    char title[12];
+    char line[LCD_COLS + 1];
+
+    if (force) {
+        snprintf(title, sizeof(title), "BEER %dh", HISTORY_5M_BUCKETS * 5 / 60);
+        snprintf(line, sizeof(line), "%-10s%5s%5s", title, "lo", "hi");
+        lcd_gotoxy(0, 0);
+        lcd_puts(line);
+    }
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        int64_t first, end;
+        history_get_range(F1_SENSOR_BEER + fridge_num * SENSOR_FIELDS_PER_FRIDGE, HISTORY_TIER_5M, &first, &end);
+        if (force || end != graph_end[fridge_num]) {
+            graph_end[fridge_num] = end;
+            graph_display_fridge(fridge_num, end);
+        }
+    }
+}
+
+
+/// @brief Displays the profile screen.
+static void profile_display(void) {
+    int64_t now_us = esp_timer_get_time();
+    char line[LCD_COLS + 1];
+    char step[8];
+    char left[8];
+
+    snprintf(line, sizeof(line), "%-8s%5s%7s", "PROFILE", "step", "left");
+    lcd_gotoxy(0, 0);
+    lcd_puts(line);
+
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        struct profile_status_t p;
+        profile_get_status(fridge_num, now_us, &p);
+
+        if (p.num_steps == 0) {
+            snprintf(step, sizeof(step), "--");
+        } else {
+            snprintf(step, sizeof(step), "%d/%d", p.step + 1, p.num_steps);
+        }
+        if (p.state == PROFILE_OFF) {
+            snprintf(left, sizeof(left), "off");
+        } else if (p.state == PROFILE_DONE) {
+            snprintf(left, sizeof(left), "done");
+        } else {
+            uint32_t minutes = (p.left_s + 59) / 60;
+            if (minutes >= 24 * 60) {
+                snprintf(left, sizeof(left), "%lud%02luh", (unsigned long)(minutes / (24 * 60)),
+                         (unsigned long)(minutes / 60 % 24));
+            } else if (minutes >= 60) {
+                snprintf(left, sizeof(left), "%luh%02lum", (unsigned long)(minutes / 60), (unsigned long)(minutes % 60));
+            } else {
+                snprintf(left, sizeof(left), "%lum", (unsigned long)minutes);
+            }
+        }
+        snprintf(line, sizeof(line), "F%d %-4s %5s %6s", fridge_num + 1,
+                 p.num_steps > 0 ? profile_step_name(p.type) : "", step, left);
+        lcd_gotoxy(0, fridge_num + 1);
+        lcd_puts(line);
+    }
+}
+
+
+/// @brief Starts (or restarts) one of the UI timers.
+/// @param timer the timer, eg. UI_TIMER_BLINK
+/// @param ms the time until the timer expires
+static void start_timer(enum ui_timer_t timer, int ms) {
+    deadline_set(timer, xTaskGetTickCount() + pdMS_TO_TICKS(ms));
+}
+
+
+/// @brief Hides the field being edited and arranges for it to be shown again.
+static void blink_hide(void) {
+    lcd_hide(blink_x, blink_y, 4);
+    blink_hidden = true;
+    start_timer(UI_TIMER_BLINK, UI_BLINK_MS);
+}
+
+
+/// @brief Displays the fridge power state indicators, if not in SLEEP or a SENSOR mode.
+/// @param force true to redraw the indicators even if they haven't changed
+static void show_power_state(bool force) {
+    static enum power_state_t shown_state[2];
+
+    if (mode >= UI_MODE_STATUS && mode < UI_MODE_SENSOR_1) {
+        for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+            if (force || shown_state[fridge_num] != power_state[fridge_num]) {
+                //      01234567890123456789
+                //      FRIDGE *1  FRIDGE ^2
+                lcd_gotoxy(7 + fridge_num * 11, 0);
+                lcd_putc(power_state_indicator[power_state[fridge_num]]);
+                shown_state[fridge_num] = power_state[fridge_num];
+            }
+        }
+    }
+}
+
+
 /// @brief Initialises the driver for the control knob (rotary encoder).
 /// @param  void 
 static void encoder_init(void) {
-    encoder_event_queue = xQueueCreate(RE_EVENT_QUEUE_SIZE, sizeof(rotary_encoder_event_t));
+    if (RE_USE_PCNT) {
+        ESP_ERROR_CHECK(encoder_pcnt_init(encoder_event_queue));
+        return;
+    }
     ESP_ERROR_CHECK(rotary_encoder_init(encoder_event_queue));
 
     // Add one encoder
@@ -248,12 +659,12 @@ static void encoder_init(void) {
 /// @return the index of the sensor in the array or zero if it wasn't found
 static int find_sensor(ds18x20_addr_t addr) {
     int i;
-    for (i = 0; i < temp_data.num_sensors; i += 1) {
-        if (temp_data.addr[i] == addr) {
+    for (i = 0; i < pTemp_data->num_sensors; i += 1) {
+        if (pTemp_data->addr[i] == addr) {
             break;
         }
     }
-    if (temp_data.addr[i] == addr) {
+    if (pTemp_data->addr[i] == addr) {
         return i;
     } else {
         return 0;
@@ -266,16 +677,16 @@ static void show_sensors(void) {
     bool addr_found = false;
 
     // show abbreviated romcodes of attached sensors
-    for (int i = 0; i < temp_data.num_sensors; i += 1) {
+    for (int i = 0; i < pTemp_data->num_sensors; i += 1) {
         lcd_gotoxy((i % 4) * 5, (i / 4) + 1);
         if (i == 0) {
             lcd_puts(" off");
         } else {
             // show CRC and most significant address byte
-            snprintf(buf, sizeof(buf), "%04x", (uint16_t)(temp_data.addr[i] >> (64 - 16)));
+            snprintf(buf, sizeof(buf), "%04x", (uint16_t)(pTemp_data->addr[i] >> (64 - 16)));
             lcd_puts(buf);
         }
-        if (temp_data.addr[i] == addr) {
+        if (pTemp_data->addr[i] == addr) {
             addr_found = true;
             blink_x = (i % 4) * 5;
             blink_y = (i / 4) + 1;
@@ -283,7 +694,7 @@ static void show_sensors(void) {
     }
 
     // erase any unused slots
-    for (int i = temp_data.num_sensors; i < MAX_TEMP_SENSORS; i += 1) {
+    for (int i = pTemp_data->num_sensors; i < MAX_TEMP_SENSORS; i += 1) {
         lcd_gotoxy((i % 4) * 5, (i / 4) + 1);
         lcd_puts("    ");
     }
@@ -305,8 +716,7 @@ void new_mode_set(int i) {
     blink_x = set_field[i].data_x;
     blink_y = set_field[i].data_y;
     blink_enabled = true;
-    lcd_hide(blink_x, blink_y, 4);
-    timeout_count = 0;
+    blink_hide();
 }
 
 
@@ -326,8 +736,7 @@ void new_mode_sensor(int i) {
     addr = sensor_field[i].addr;
     show_sensors();
     blink_enabled = true;
-    lcd_hide(blink_x, blink_y, 4);
-    timeout_count = 0;
+    blink_hide();
 }
 
 
@@ -337,6 +746,11 @@ void new_mode_sensor(int i) {
 ///
 static void new_mode(void) {
     blink_enabled = false;
+    deadline_cancel(UI_TIMER_BLINK);
+    lowpower_set_mode(mode == UI_MODE_SLEEP ? LP_MODE_SLEEP : LP_MODE_ACTIVE);
+    if (RE_USE_PCNT) {
+        encoder_pcnt_enable_rotation(mode != UI_MODE_SLEEP);
+    }
     switch (mode) {
         case UI_MODE_SPLASH:
             lcd_clear();
@@ -374,8 +788,7 @@ static void new_mode(void) {
             lcd_clear();
             lcd_puts("FRIDGE  1  FRIDGE  2");
             for (int i = 0; i < num_set_fields; i += 1) {
-                lcd_gotoxy(set_field[i].title_x, set_field[i].title_y);
-                lcd_puts(set_field[i].title);
+                set_field_title_display(i);
                 lcd_gotoxy(set_field[i].data_x, set_field[i].data_y);
                 value_to_temp_str(buf, sizeof(buf), set_field[i].value);
                 lcd_puts(buf);
@@ -428,10 +841,31 @@ static void new_mode(void) {
             new_mode_sensor(6);
             break;
 
+        case UI_MODE_ENERGY:
+            lcd_clear();
+            energy_display();
+            break;
+
+        case UI_MODE_STATS:
+            lcd_clear();
+            stats_display();
+            break;
+
+        case UI_MODE_GRAPH:
+            lcd_clear();
+            graph_display(true);
+            break;
+
+        case UI_MODE_PROFILE:
+            lcd_clear();
+            profile_display();
+            break;
+
         default:
-            ESP_LOGE(TAG, "unrecognised mode");
+            BINLOG_E("unrecognised mode");
             break;
     }
+    show_power_state(true);
 }
 
 
@@ -440,7 +874,7 @@ static void new_mode(void) {
 /// Any fields without a reading are set to UNDEFINED_TEMP 
 ///
 /// @param pTemp an array of sensor readings
-static void update_sensor_temps(struct temp_data_t *pTemp) {
+static void update_sensor_temps(const struct temp_data_t *pTemp) {
     for (int f = 0; f < num_sensor_fields; f += 1) {
         sensor_field[f].temp = UNDEFINED_TEMP;
         if (sensor_field[f].addr != 0) {
@@ -454,6 +888,32 @@ static void update_sensor_temps(struct temp_data_t *pTemp) {
 }
 
 
+/// @brief Scales a change from the encoder by how fast the knob is being turned.
+///
+/// Below RE_ACCEL_MIN_RATE detents per second each detent counts once. Above
+/// that the multiplier rises in proportion to the speed, up to RE_ACCEL_MAX.
+///
+/// @param diff the number of detents turned since the last change
+/// @return the accelerated change
+static int accelerate(int diff) {
+    static int64_t last_change_us;
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = now_us - last_change_us;
+    last_change_us = now_us;
+
+    int detents = (diff < 0) ? -diff : diff;
+    int64_t rate = (elapsed_us > 0) ? detents * 1000000LL / elapsed_us : 0;
+    int64_t multiplier = rate / RE_ACCEL_MIN_RATE;
+
+    if (multiplier < 1) {
+        multiplier = 1;
+    } else if (multiplier > RE_ACCEL_MAX) {
+        multiplier = RE_ACCEL_MAX;
+    }
+    return diff * (int)multiplier;
+}
+
+
 /// @brief Changes a setting by a certain amount.
 ///
 /// This is called by ui_event_handler() in response to a RE_ET_CHANGED
@@ -462,6 +922,12 @@ static void update_sensor_temps(struct temp_data_t *pTemp) {
 /// @param i the index of the setting to be changed, eg. F1_SET
 /// @param diff the amount to change from the current value.
 static void set_field_value_change(int i, int diff) {
+    // setting a beer temperature by hand takes over from the fridge's profile
+    if (set_by_profile(i)) {
+        profile_stop(i - F1_SET);
+        BINLOG_I("profile: fridge %d stopped by a set point change", i - F1_SET + 1);
+        set_field_title_display(i);
+    }
     if (set_field[i].value == UNDEFINED_TEMP) {
         set_field[i].value = 0;
     }
@@ -469,10 +935,12 @@ static void set_field_value_change(int i, int diff) {
     if (set_field[i].value < 0) {
         set_field[i].value = UNDEFINED_TEMP;
     }
+    telemetry_send_setpoint(i, set_field[i].value);
     lcd_gotoxy(set_field[i].data_x, set_field[i].data_y);
     value_to_temp_str(buf, sizeof(buf), set_field[i].value);
     lcd_puts(buf);
-    timeout_count = 2;      // reset the inactivity timer
+    blink_hidden = false;   // keep the field visible while it's being changed
+    start_timer(UI_TIMER_BLINK, UI_BLINK_MS * 2);
 }
 
 
@@ -486,16 +954,15 @@ static void set_field_value_change(int i, int diff) {
 static void sensor_addr_change(int i, int diff) {
     i -= 1;
     int sensor_index = find_sensor(addr);
-    sensor_index = (sensor_index + diff) % (int)temp_data.num_sensors;
+    sensor_index = (sensor_index + diff) % (int)pTemp_data->num_sensors;
     if (sensor_index < 0) {
-        sensor_index += temp_data.num_sensors;  // user moved backwards - wrap around
+        sensor_index += pTemp_data->num_sensors;  // user moved backwards - wrap around
     }
-    addr = temp_data.addr[sensor_index];
+    addr = pTemp_data->addr[sensor_index];
     sensor_field[i].addr = addr;
     blink_x = (sensor_index % 4) * 5;
     blink_y = (sensor_index / 4) + 1;
-    lcd_hide(blink_x, blink_y, 4);
-    timeout_count = 0;
+    blink_hide();
     sensor_addresses_changed = true;  // update the non-volatile storage when we return to MODE_STATUS
 }
 
@@ -518,7 +985,7 @@ static void ui_event_handler(enum ui_event_t event, int value_change) {
 
         case UI_EVENT_TIMEOUT:
             // don't timeout in sensor selection modes
-            if (mode != next_state_timeout[mode] && mode < UI_MODE_SENSOR_1) {
+            if (mode != next_state_timeout[mode] && (mode < UI_MODE_SENSOR_1 || mode > UI_MODE_SENSOR_6)) {
                 mode = next_state_timeout[mode];
                 new_mode();
             }
@@ -527,28 +994,80 @@ static void ui_event_handler(enum ui_event_t event, int value_change) {
         case UI_EVENT_VALUE_CHANGE:
             lcd_restore();
             switch (mode) {
+                case UI_MODE_STATUS:
+                    mode = UI_MODE_GRAPH;
+                    new_mode();
+                    break;
+
+                case UI_MODE_GRAPH:
+                    if (value_change < 0) {
+                        mode = UI_MODE_STATUS;
+                        new_mode();
+                    } else {
+                        mode = UI_MODE_ENERGY;
+                        energy_view = 0;
+                        new_mode();
+                    }
+                    break;
+
+                case UI_MODE_ENERGY:
+                    energy_view += value_change;
+                    if (energy_view < 0) {
+                        mode = UI_MODE_GRAPH;
+                        new_mode();
+                    } else if (energy_view >= ENERGY_VIEWS) {
+                        mode = UI_MODE_STATS;
+                        stats_view = 0;
+                        new_mode();
+                    } else {
+                        energy_display();
+                    }
+                    break;
+
+                case UI_MODE_STATS:
+                    stats_view += value_change;
+                    if (stats_view < 0) {
+                        mode = UI_MODE_ENERGY;
+                        energy_view = ENERGY_VIEWS - 1;
+                        new_mode();
+                    } else if (stats_view >= STATS_VIEWS) {
+                        mode = UI_MODE_PROFILE;
+                        new_mode();
+                    } else {
+                        stats_display();
+                    }
+                    break;
+
+                case UI_MODE_PROFILE:
+                    if (value_change < 0) {
+                        mode = UI_MODE_STATS;
+                        stats_view = STATS_VIEWS - 1;
+                        new_mode();
+                    }
+                    break;
+
                 case UI_MODE_SET_1:
-                    set_field_value_change(0, value_change);
+                    set_field_value_change(0, accelerate(value_change));
                     break;
 
                 case UI_MODE_SET_2:
-                    set_field_value_change(1, value_change);
+                    set_field_value_change(1, accelerate(value_change));
                     break;
 
                 case UI_MODE_SET_3:
-                    set_field_value_change(2, value_change);
+                    set_field_value_change(2, accelerate(value_change));
                     break;
 
                 case UI_MODE_SET_4:
-                    set_field_value_change(3, value_change);
+                    set_field_value_change(3, accelerate(value_change));
                     break;
 
                 case UI_MODE_SET_5:
-                    set_field_value_change(4, value_change);
+                    set_field_value_change(4, accelerate(value_change));
                     break;
 
                 case UI_MODE_SET_6:
-                    set_field_value_change(5, value_change);
+                    set_field_value_change(5, accelerate(value_change));
                     break;
 
                 case UI_MODE_SENSOR_1:
@@ -581,43 +1100,282 @@ static void ui_event_handler(enum ui_event_t event, int value_change) {
             break;
 
         case UI_EVENT_BLINK:
-            if (mode == UI_MODE_STATUS) {
-                status_display_sensor_temps();
-            } else if (blink_enabled) {
-                if (timeout_count == 0) {
+            if (blink_enabled) {
+                if (blink_hidden) {
+                    lcd_restore();
+                    blink_hidden = false;
+                    start_timer(UI_TIMER_BLINK, UI_BLINK_MS * (UI_BLINKS_PER_FLASH - 1));
+                } else {
                     if (mode >= UI_MODE_SENSOR_1) {
                         // update list in sensor selection modes
                         show_sensors();
                     }
-                    lcd_hide(blink_x, blink_y, 4);
-                } else if (timeout_count == 1) {
-                    lcd_restore();
+                    blink_hide();
                 }
             }
             break;
 
         case UI_EVENT_SLEEP:
             mode = UI_MODE_SLEEP;
+            lcd_restore();
+            blink_enabled = false;                          // stop blinking a field in the dark
+            deadline_cancel(UI_TIMER_BLINK);
             lcd_switch_backlight(false);
+            lowpower_set_mode(LP_MODE_SLEEP);
+            if (RE_USE_PCNT) {
+                encoder_pcnt_enable_rotation(false);
+            }
             break;
 
         case UI_EVENT_NEW_TEMP_DATA:
-            update_sensor_temps(&(temp_data));
+            update_sensor_temps(pTemp_data);
+            if (mode == UI_MODE_STATUS) {
+                status_display_sensor_temps();
+            } else if (mode == UI_MODE_GRAPH) {
+                graph_display(false);
+            }
             break;
 
         default:
-            ESP_LOGE(TAG, "unrecognised event");
+            BINLOG_E("unrecognised event");
             break;
     }
 }
 
 
+/// @brief Tells the sensor task which sensor is assigned to each field, and the sensor
+/// task and the history the temperature at which the control loop acts on it.
+///
+/// The thresholds are the set point for the beer sensor, and the air and heater limits
+/// derived from the beer temperature and the cool/heat offsets.
+static void publish_sensor_fields(void) {
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        int set_value = set_field[F1_SET + fridge_num].value;
+        int cool_value = set_field[F1_COOL + fridge_num].value;
+        int heat_value = set_field[F1_HEAT + fridge_num].value;
+        int beer = F1_SENSOR_BEER + fridge_num * SENSOR_FIELDS_PER_FRIDGE;
+        int air = F1_SENSOR_AIR + fridge_num * SENSOR_FIELDS_PER_FRIDGE;
+        int heat = F1_SENSOR_HEAT + fridge_num * SENSOR_FIELDS_PER_FRIDGE;
+        float beer_temp = sensor_field[beer].temp;
+
+        float beer_threshold = UNDEFINED_TEMP;
+        float air_threshold = UNDEFINED_TEMP;
+        float heat_threshold = UNDEFINED_TEMP;
+        if (set_value != UNDEFINED_TEMP) {
+            beer_threshold = set_value / 10.0;
+            if (beer_temp != UNDEFINED_TEMP && cool_value != UNDEFINED_TEMP) {
+                air_threshold = beer_temp - cool_value / 10.0;
+            }
+            if (beer_temp != UNDEFINED_TEMP && heat_value != UNDEFINED_TEMP) {
+                heat_threshold = beer_temp + heat_value / 10.0;
+            }
+        }
+
+        sensor_set_field(beer, sensor_field[beer].addr, beer_threshold);
+        sensor_set_field(air, sensor_field[air].addr, air_threshold);
+        sensor_set_field(heat, sensor_field[heat].addr, heat_threshold);
+        history_set_setpoint(beer, beer_threshold);
+        history_set_setpoint(air, air_threshold);
+        history_set_setpoint(heat, heat_threshold);
+    }
+}
+
+
+/// @brief Sets the beer set points of the fridges with a running profile.
+///
+/// While a profile runs, the set point's title on the settings screen is "prof".
+/// Changing the set point by hand stops the profile (see set_field_value_change()),
+/// so this never overwrites an edit.
+static void apply_profiles(void) {
+    int64_t now_us = esp_timer_get_time();
+
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        int i = F1_SET + fridge_num;
+        int value = profile_update(fridge_num, now_us);
+        if (value != UNDEFINED_TEMP && value != set_field[i].value) {
+            set_field[i].value = value;
+            telemetry_send_setpoint(i, value);
+            if (mode >= UI_MODE_SET_1 && mode <= UI_MODE_SET_6) {
+                lcd_gotoxy(set_field[i].data_x, set_field[i].data_y);
+                value_to_temp_str(buf, sizeof(buf), value);
+                lcd_puts(buf);
+            }
+        }
+        if (mode >= UI_MODE_SET_1 && mode <= UI_MODE_SET_6) {
+            set_field_title_display(i);     // a profile may have been started, stopped or finished
+        }
+    }
+}
+
+
+/// @brief Updates the power state of the fridges from the latest settings and sensor readings.
+///
+/// This runs whenever new readings arrive, and otherwise after CONTROL_PERIOD_MS
+/// so that the power state timers are still serviced if the sensors stop. The
+/// load scheduler is told how far each fridge is from its set point, so the
+/// furthest one starts first.
+static void control_update(void) {
+    apply_profiles();
+    for (int fridge_num = 0; fridge_num < 2; fridge_num += 1) {
+        int set_value = set_field[F1_SET + fridge_num].value;
+        float beer_temp = sensor_field[F1_SENSOR_BEER + fridge_num * SENSOR_FIELDS_PER_FRIDGE].temp;
+        bool defined = (set_value != UNDEFINED_TEMP && beer_temp != UNDEFINED_TEMP);
+        load_set_error(fridge_num, defined ? beer_temp - set_value / 10.0 : 0);
+    }
+
+    power_update (
+        0,      // fridge 1 
+        cooling_needed(
+            set_field[F1_SET].value,
+            set_field[F1_COOL].value,
+            sensor_field[F1_SENSOR_BEER].temp,
+            sensor_field[F1_SENSOR_AIR].temp),
+        heating_needed(
+            set_field[F1_SET].value,
+            set_field[F1_HEAT].value,
+            sensor_field[F1_SENSOR_BEER].temp,
+            sensor_field[F1_SENSOR_HEAT].temp));
+
+    power_update (
+        1,      // fridge 2 
+        cooling_needed(
+            set_field[F2_SET].value,
+            set_field[F2_COOL].value,
+            sensor_field[F2_SENSOR_BEER].temp,
+            sensor_field[F2_SENSOR_AIR].temp),
+        heating_needed(
+            set_field[F2_SET].value,
+            set_field[F2_HEAT].value,
+            sensor_field[F2_SENSOR_BEER].temp,
+            sensor_field[F2_SENSOR_HEAT].temp));
+
+    load_schedule(xTaskGetTickCount());                 // grant any starts, for the next update
+    failsafe_feed(FAILSAFE_CONTROL);
+
+    if (sample_us != 0) {
+        metrics_record(METRIC_SAMPLE_TO_CONTROL, esp_timer_get_time() - sample_us);
+        sample_us = 0;
+    }
+
+    publish_sensor_fields();
+    show_power_state(false);
+    if (mode == UI_MODE_ENERGY) {
+        energy_display();                               // the display task only sends what's changed
+    } else if (mode == UI_MODE_STATS) {
+        stats_display();
+    } else if (mode == UI_MODE_PROFILE) {
+        profile_display();
+    }
+    start_timer(UI_TIMER_CONTROL, CONTROL_PERIOD_MS);
+}
+
+
+/// @brief Handles an expired UI timer.
+/// @param timer the timer, eg. UI_TIMER_BLINK
+static void ui_timer_handler(enum ui_timer_t timer) {
+    switch (timer) {
+        case UI_TIMER_BLINK:
+            ui_event_handler(UI_EVENT_BLINK, 0);
+            break;
+
+        case UI_TIMER_TIMEOUT:
+            ui_event_handler(UI_EVENT_TIMEOUT, 0);
+            break;
+
+        case UI_TIMER_SLEEP:
+            ui_event_handler(UI_EVENT_SLEEP, 0);
+            break;
+
+        case UI_TIMER_CONTROL:
+            control_update();
+            break;
+
+        case UI_TIMER_JITTER:
+#if JITTER_ENABLE
+            jitter_control_tick();
+            jitter_due += pdMS_TO_TICKS(CONTROL_PERIOD_MS);     // at a fixed rate, so only lateness moves it
+            deadline_set(UI_TIMER_JITTER, jitter_due);
+#endif
+            break;
+    }
+}
+
+
+/// @brief Adds up any further rotation events already waiting in the encoder queue.
+///
+/// This means a fast turn is handled with a single update and redraw. Each event
+/// is taken through the queue set first, so that the set doesn't fill up with
+/// entries for events that have gone: a full set fails the next send to it. If
+/// the set gives up the temperature queue's entry on the way, temp_pending
+/// keeps it for the event loop.
+///
+/// @param diff the change from the event that has already been received
+/// @return the total change
+static int32_t coalesce_changes(int32_t diff) {
+    rotary_encoder_event_t next;
+    while (xQueuePeek(encoder_event_queue, &next, 0) == pdTRUE && next.type == RE_ET_CHANGED) {
+        QueueSetMemberHandle_t queue = xQueueSelectFromSet(ui_queue_set, 0);
+        if (queue == temperature_queue) {
+            temp_pending = true;
+            queue = xQueueSelectFromSet(ui_queue_set, 0);
+        }
+        if (queue != encoder_event_queue) {
+            break;
+        }
+        xQueueReceive(encoder_event_queue, &next, 0);
+        diff += next.diff;
+    }
+    return diff;
+}
+
+
+/// @brief Creates the encoder queue, and a queue set so the event loop can wait for the encoder
+/// and the sensor task at once.
+///
+/// A queue must be empty when it's added to a set, so this is called from app_main() after
+/// the temperature queue is created, but before the sensor task (which may run on the other
+/// core) and the encoder driver can send anything.
+void ui_init(void) {
+    encoder_event_queue = xQueueCreateStatic(RE_EVENT_QUEUE_SIZE, sizeof(rotary_encoder_event_t),
+                                             encoder_event_queue_storage, &encoder_event_queue_buf);
+    ui_queue_set = xQueueCreateSet(RE_EVENT_QUEUE_SIZE + 1);     // FreeRTOS has no static queue sets
+    if (!ui_queue_set) {
+        ESP_LOGE(TAG, "can't create UI queue set");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        abort();
+    }
+
+    configASSERT(xQueueAddToSet(encoder_event_queue, ui_queue_set) == pdPASS);
+#if TRACE_ENABLE
+    trace_register_queue(encoder_event_queue, TRACE_QUEUE_ENCODER);
+#endif
+    configASSERT(xQueueAddToSet(temperature_queue, ui_queue_set) == pdPASS);
+}
+
+
+/// @brief Copies the settings and readings for ui_get_state(), once the UI has finished with an event.
+///
+/// Only the UI task writes the fields, so between events they're consistent;
+/// the copy is made under a lock so that a reader never sees half of it.
+static void publish_state(void) {
+    _Static_assert(sizeof(set_field) / sizeof(set_field[0]) == NUM_SET_FIELDS, "set fields don't match types.h");
+    _Static_assert(sizeof(sensor_field) / sizeof(sensor_field[0]) == MAX_SENSOR_FIELDS, "sensor fields don't match types.h");
+
+    portENTER_CRITICAL(&published_lock);
+    for (int i = 0; i < NUM_SET_FIELDS; i += 1) {
+        published.set[i] = set_field[i].value;
+    }
+    for (int i = 0; i < MAX_SENSOR_FIELDS; i += 1) {
+        published.temp[i] = sensor_field[i].temp;
+    }
+    portEXIT_CRITICAL(&published_lock);
+}
+
+
 /// @brief Prepares the UI and continually runs the event loop.
 /// @param pParams the parameters passed by xTaskCreate(): not used.
 void ui_task(void *pParams) {
     rotary_encoder_event_t e;
-    static int long_timeout_count;
-    static int sleep_timeout_count;
 
     // prepare the UI
     //
@@ -626,50 +1384,45 @@ void ui_task(void *pParams) {
     read_sensor_addresses(sensor_field, num_sensor_fields);  // load 1-Wire addresses from flash
     new_mode();     // set up the first screen
 
+    start_timer(UI_TIMER_TIMEOUT, UI_BLINK_MS * UI_BLINKS_PER_TIMEOUT);
+    start_timer(UI_TIMER_SLEEP, UI_BLINK_MS * UI_BLINKS_PER_SLEEP);
+    start_timer(UI_TIMER_CONTROL, 0);
+#if JITTER_ENABLE
+    jitter_due = xTaskGetTickCount() + pdMS_TO_TICKS(CONTROL_PERIOD_MS);
+    deadline_set(UI_TIMER_JITTER, jitter_due);
+#endif
+
     // repeat the event loop forever
     //
+    int64_t woke_us = 0;
     for(;;) {
-        // update the power state of the fridges
+        // handle any timers that have expired
         //
-        power_update (
-            0,      // fridge 1 
-            cooling_needed(
-                set_field[F1_SET].value,
-                set_field[F1_COOL].value,
-                sensor_field[F1_SENSOR_BEER].temp,
-                sensor_field[F1_SENSOR_AIR].temp),
-            heating_needed(
-                set_field[F1_SET].value,
-                set_field[F1_HEAT].value,
-                sensor_field[F1_SENSOR_BEER].temp,
-                sensor_field[F1_SENSOR_HEAT].temp));
-
-        power_update (
-            1,      // fridge 2 
-            cooling_needed(
-                set_field[F2_SET].value,
-                set_field[F2_COOL].value,
-                sensor_field[F2_SENSOR_BEER].temp,
-                sensor_field[F2_SENSOR_AIR].temp),
-            heating_needed(
-                set_field[F2_SET].value,
-                set_field[F2_HEAT].value,
-                sensor_field[F2_SENSOR_BEER].temp,
-                sensor_field[F2_SENSOR_HEAT].temp));
-
-        // display the fridge power state indicators, if not in SLEEP or a SENSOR mode
-        if (mode >= UI_MODE_STATUS && mode < UI_MODE_SENSOR_1) {
-                //      01234567890123456789
-                //      FRIDGE *1  FRIDGE ^2
-                lcd_gotoxy(7, 0);
-                lcd_putc(power_state_indicator[power_state[0]]);
-                lcd_gotoxy(18, 0);
-                lcd_putc(power_state_indicator[power_state[1]]);
+        int timer;
+        while ((timer = deadline_pop_expired(xTaskGetTickCount())) != DEADLINE_NONE) {
+            ui_timer_handler(timer);
+        }
+        publish_state();
+        if (woke_us != 0) {
+            metrics_record(METRIC_UI_LOOP, esp_timer_get_time() - woke_us);
         }
 
-        // wait up to `UI_BLINK_MS` for an event from the rotary encoder
+        // sleep until the next timer expires, unless there's an event from the rotary encoder
+        // or new temperature data first (or there's new data that coalesce_changes() found)
         //
-        if (xQueueReceive(encoder_event_queue, &e, pdMS_TO_TICKS(UI_BLINK_MS)) == pdTRUE) {
+        QueueSetMemberHandle_t queue = temperature_queue;
+        if (temp_pending) {
+            temp_pending = false;
+        } else {
+            if (!RE_USE_PCNT) {
+                lowpower_arm_wakeup();                      // the PCNT backend arms its own wakeup
+            }
+            queue = xQueueSelectFromSet(ui_queue_set, deadline_wait_time(xTaskGetTickCount()));
+            lowpower_count_wakeup(LP_SOURCE_UI);
+        }
+        woke_us = esp_timer_get_time();
+
+        if (queue == encoder_event_queue && xQueueReceive(encoder_event_queue, &e, 0) == pdTRUE) {
 
             switch (e.type) {                               // handle the encoder event
                 case RE_ET_BTN_CLICKED:
@@ -680,44 +1433,79 @@ void ui_task(void *pParams) {
                     ui_event_handler(UI_EVENT_BTN_LONG_PRESS, 0);
                     break;
 
-                case RE_ET_CHANGED:
-                    ui_event_handler(UI_EVENT_VALUE_CHANGE, e.diff);
+                case RE_ET_CHANGED: {
+                    int diff = coalesce_changes(e.diff);
+                    if (diff != 0) {                        // turns that cancel out go nowhere
+                        ui_event_handler(UI_EVENT_VALUE_CHANGE, diff);
+                    }
                     break;
+                }
 
                 default:
                     break;
             }
 
-            long_timeout_count = 0;                         // reset the inactivity timers
-            sleep_timeout_count = 0;
-
-        } else {
-            // if there are no rotary encoder events then manage the periodic "housekeeping" events
-            //
-            timeout_count = (timeout_count + 1) % UI_BLINKS_PER_FLASH;
-            ui_event_handler(UI_EVENT_BLINK, 0);
+            // reset the inactivity timers
+            start_timer(UI_TIMER_TIMEOUT, UI_BLINK_MS * UI_BLINKS_PER_TIMEOUT);
+            start_timer(UI_TIMER_SLEEP, UI_BLINK_MS * UI_BLINKS_PER_SLEEP);
 
-            long_timeout_count = (long_timeout_count + 1) % UI_BLINKS_PER_TIMEOUT;
-            if (long_timeout_count == 0) {
-                ui_event_handler(UI_EVENT_TIMEOUT, 0);
-            }
-
-            sleep_timeout_count = (sleep_timeout_count + 1) % UI_BLINKS_PER_SLEEP;
-            if (sleep_timeout_count == 0) {
-                ui_event_handler(UI_EVENT_SLEEP, 0);
+        } else if (queue == temperature_queue) {
+            // the sensor task won't write to these readings until we've received the next ones
+            if (xQueueReceive(temperature_queue, &(pTemp_data), 0) == pdTRUE) {
+                sample_us = pTemp_data->timestamp_us;
+                ui_event_handler(UI_EVENT_NEW_TEMP_DATA, 0);
+                control_update();                               // act on the new readings straight away
             }
         }
+    }
+}
 
-        // always check for new temperature data
-        //
-        struct temp_data_t *pTemp_data;
-        if (xQueuePeek(temperature_queue, &(pTemp_data), 0) == pdTRUE) {
-            temp_data = *pTemp_data;                        // take local copy
-            ui_event_handler(UI_EVENT_NEW_TEMP_DATA, 0);    // process local copy
 
-            // un-block the queue so that the sending task can continue
-            xQueueReceive(temperature_queue, &(pTemp_data), 0);
-        }
+/// @brief Gets the settings and readings as they were after the UI's last event, for other tasks.
+///
+/// The copy is taken under the same lock that publish_state() holds while
+/// writing it, so all the values are from the same moment.
+///
+/// @param pState where to store the settings and readings
+void ui_get_state(struct ui_state_t *pState) {
+    portENTER_CRITICAL(&published_lock);
+    *pState = published;
+    portEXIT_CRITICAL(&published_lock);
+}
+
+
+#if BENCH_ENABLE
+// benchmark hooks
+// ---------------
+// These give bench.c access to the UI's private functions and data.
 
+/// @brief Replaces the sensor data and assigns the sensors to the fields in turn.
+/// @param pTemp the sensor data, which must stay in place while the benchmarks run
+void ui_bench_load(const struct temp_data_t *pTemp) {
+    pTemp_data = pTemp;
+    for (int f = 0; f < num_sensor_fields; f += 1) {
+        sensor_field[f].addr = (f < pTemp_data->num_sensors) ? pTemp_data->addr[f] : 0;
     }
+    update_sensor_temps(pTemp_data);
+}
+
+void ui_bench_update_sensor_temps(void) {
+    update_sensor_temps(pTemp_data);
+}
+
+int ui_bench_find_sensor(ds18x20_addr_t addr) {
+    return find_sensor(addr);
+}
+
+void ui_bench_format_temp(int value) {
+    value_to_temp_str(buf, sizeof(buf), value);
+}
+
+void ui_bench_redraw(void) {
+    status_display_sensor_temps();
+}
+
+void ui_bench_save(void) {
+    write_sensor_addresses(sensor_field, num_sensor_fields);
 }
+#endif
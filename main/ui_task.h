@@ -1 +1,21 @@
+#include "defines.h"
+#include "types.h"
+
+struct ui_state_t {
+    int set[NUM_SET_FIELDS];                // eg. F1_SET, in 1/10 C or UNDEFINED_TEMP
+    float temp[MAX_SENSOR_FIELDS];          // eg. F1_SENSOR_BEER, or UNDEFINED_TEMP
+};
+
+void ui_init(void);
 void ui_task(void *pParams);
+void ui_get_state(struct ui_state_t *pState);
+
+#if BENCH_ENABLE
+// hooks for the benchmarks in bench.c
+void ui_bench_load(const struct temp_data_t *pTemp);
+void ui_bench_update_sensor_temps(void);
+int ui_bench_find_sensor(ds18x20_addr_t addr);
+void ui_bench_format_temp(int value);
+void ui_bench_redraw(void);
+void ui_bench_save(void);
+#endif
@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+
+#include "defines.h"
+#include "wifi.h"
+
+#if MQTT_ENABLE || HTTP_ENABLE
+
+#include <esp_wifi.h>
+#include <esp_netif.h>
+#include <esp_event.h>
+
+// The WiFi station that the MQTT publisher and the HTTP server share. It
+// connects in the background, and reconnects whenever it loses the network.
+
+static bool started;
+
+
+static void on_wifi_event(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    if (id == WIFI_EVENT_STA_START || id == WIFI_EVENT_STA_DISCONNECTED) {
+        esp_wifi_connect();                 // and keep trying
+    }
+}
+
+
+/// @brief Starts connecting to WIFI_SSID, if that hasn't been done yet (call after NVS is initialised).
+void wifi_init(void) {
+    wifi_init_config_t wifi_init = WIFI_INIT_CONFIG_DEFAULT();
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASSWORD
+        }
+    };
+
+    if (started) {
+        return;
+    }
+    started = true;
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    esp_netif_create_default_wifi_sta();
+    ESP_ERROR_CHECK(esp_wifi_init(&wifi_init));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, on_wifi_event, NULL));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+}
+
+#endif // MQTT_ENABLE || HTTP_ENABLE
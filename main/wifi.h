@@ -0,0 +1,6 @@
+#ifndef WIFI_H
+#define WIFI_H
+
+void wifi_init(void);
+
+#endif // WIFI_H
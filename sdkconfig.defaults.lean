@@ -0,0 +1,22 @@
+# lean build: the smallest image that keeps every function of the controller,
+# applied on top of sdkconfig.defaults in its own build directory:
+#
+#   idf.py -B build-lean -D SDKCONFIG=build-lean/sdkconfig \
+#          -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;sdkconfig.defaults.lean" build
+#
+# The footprint report after the build checks it against the lean budgets in
+# the top level CMakeLists.txt.
+
+# optimise for size, and keep the asserts without their messages
+CONFIG_COMPILER_OPTIMIZATION_SIZE=y
+CONFIG_COMPILER_OPTIMIZATION_ASSERTIONS_SILENT=y
+CONFIG_BOOTLOADER_COMPILER_OPTIMIZATION_SIZE=y
+
+# newlib-nano printf: no floating point or 64 bit formats, which the firmware
+# doesn't use (the binary log is formatted on the host)
+CONFIG_NEWLIB_NANO_FORMAT=y
+
+# compile out ESP_LOGx() in the app (the maximum level follows the default) and
+# the bootloader; the console and the binary log are unaffected
+CONFIG_LOG_DEFAULT_LEVEL_NONE=y
+CONFIG_BOOTLOADER_LOG_LEVEL_NONE=y
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Reports the flash, IRAM and DRAM used by each source file, from the linker map.
+
+Reads the map file that the IDF build writes next to the ELF, and prints the
+memory used by each object file in a component, then by each component and
+library in the image. Exits with status 1 if any budget is exceeded, which
+fails the build when run as its post-build step (see the top level
+CMakeLists.txt). A budget is SCOPE.REGION=BYTES, where SCOPE is a component
+or "all" for the whole image, and REGION is flash, iram or dram:
+
+    tools/footprint.py build/brewfridge.map --budget main.dram=49152 --budget all.flash=1048576
+
+Flash counts the code and constants run from flash, IRAM the code kept in
+internal RAM, and DRAM the static data (the initial values of .data are in
+flash too, but aren't counted there). Heap allocations made at startup by the
+drivers aren't included.
+"""
+
+import argparse
+import collections
+import re
+import sys
+
+REGIONS = ("flash", "iram", "dram")
+
+# output sections of the ESP32 memory map, by the region they're in
+SECTION_REGION = {
+    ".flash.appdesc": "flash",
+    ".flash.rodata": "flash",
+    ".flash.text": "flash",
+    ".iram0.vectors": "iram",
+    ".iram0.text": "iram",
+    ".iram0.data": "iram",
+    ".iram0.bss": "iram",
+    ".dram0.data": "dram",
+    ".dram0.bss": "dram",
+    ".noinit": "dram",
+}
+
+INPUT_SECTION = re.compile(r"^ (\.\S+|COMMON)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*))?$")
+CONTINUATION = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+ARCHIVE_MEMBER = re.compile(r"(?:.*/)?lib([^/]+)\.a\((.+?)(?:\.obj|\.o)\)$")
+
+
+def object_name(path):
+    """Turns 'esp-idf/main/libmain.a(ui_task.c.obj)' into ('main', 'ui_task.c')."""
+    m = ARCHIVE_MEMBER.match(path.strip())
+    if m:
+        return m.group(1), m.group(2)
+    return "(objects)", path.strip().rsplit("/", 1)[-1]
+
+
+def parse(lines):
+    """Returns {(component, file): {region: bytes}}."""
+    usage = collections.defaultdict(collections.Counter)
+    in_map = False
+    region = None
+    pending = False
+
+    for line in lines:
+        line = line.rstrip("\n")
+        if not in_map:
+            in_map = line.startswith("Linker script and memory map")
+            continue
+        if line and not line[0].isspace():
+            region = SECTION_REGION.get(line.split()[0])
+            pending = False
+            continue
+        if region is None:
+            continue
+
+        if pending:
+            pending = False
+            m = CONTINUATION.match(line)
+            if m:
+                size = int(m.group(2), 16)
+                if size:
+                    usage[object_name(m.group(3))][region] += size
+                continue
+        m = INPUT_SECTION.match(line)
+        if m:
+            if m.group(2) is None:
+                pending = True          # a long section name: the address, size and file are on the next line
+            else:
+                size = int(m.group(3), 16)
+                if size:
+                    usage[object_name(m.group(4))][region] += size
+    return usage
+
+
+def print_table(title, rows):
+    """Prints (name, {region: bytes}) rows, largest first, and returns their total."""
+    total = collections.Counter()
+    print("\n%-28s %8s %8s %8s" % ((title,) + REGIONS))
+    for name, u in sorted(rows, key=lambda row: [-row[1][r] for r in REGIONS]):
+        print("%-28s %8d %8d %8d" % ((name,) + tuple(u[r] for r in REGIONS)))
+        total.update(u)
+    print("%-28s %8d %8d %8d" % (("= total",) + tuple(total[r] for r in REGIONS)))
+    return total
+
+
+def budget(text):
+    m = re.match(r"^([^.=]+)\.(flash|iram|dram)=(\d+)$", text)
+    if not m:
+        raise argparse.ArgumentTypeError("expected SCOPE.REGION=BYTES, eg. main.dram=49152")
+    return m.group(1), m.group(2), int(m.group(3))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="linker map file")
+    parser.add_argument("--component", default="main", help="component to list by file (default main)")
+    parser.add_argument("--budget", type=budget, action="append", default=[],
+                        help="SCOPE.REGION=BYTES, eg. main.dram=49152 or all.flash=1048576")
+    args = parser.parse_args()
+
+    with open(args.map) as f:
+        usage = parse(f)
+
+    print_table("%s (bytes)" % args.component,
+                [(name, u) for (component, name), u in usage.items() if component == args.component])
+
+    components = collections.defaultdict(collections.Counter)
+    for (component, name), u in usage.items():
+        components[component].update(u)
+    components["all"] = print_table("component (bytes)", list(components.items()))
+
+    over = False
+    for scope, region, limit in args.budget:
+        used = components[scope][region] if scope in components else 0
+        if used > limit:
+            print("%s.%s: %d bytes is over the budget of %d" % (scope, region, used, limit), file=sys.stderr)
+            over = True
+        else:
+            print("%s.%s: %d of %d bytes budget" % (scope, region, used, limit))
+    if over:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Simulates two fridges with and without the load scheduler in main/load.c.
+
+The fridges are simple thermal models (beer, air, ambient) driven by a copy of
+the power state machine in main/power.c and the scheduler in main/load.c,
+stepped once a second like control_update(). Each run reports the peak supply
+current, counting a compressor's inrush for the second it starts, the number
+of starts that coincide with another load starting, and the beer temperature
+error once each fridge has first reached its set point.
+
+    tools/load_sim.py
+    tools/load_sim.py --hours 72 --ambient 32 --max-compressors 1
+
+The state machine and scheduler must be kept in step with the C code.
+"""
+
+import argparse
+import math
+
+# must match main/defines.h (times in seconds)
+MIN_OFF_TIME = 2 * 60
+MIN_COOLING_TIME = 30
+MAX_COOLING_TIME = 60 * 60
+LOAD_MIN_START_GAP = 10
+CONTROL_PERIOD = 1
+
+COMPRESSOR, HEATER = range(2)
+OFF, COOL_REQUESTED, COOLING, COOL_OVERRUN, HEAT_REQUESTED, HEATING = range(6)
+
+# supply current in amps
+COMPRESSOR_A = 1.0
+COMPRESSOR_INRUSH_A = 6.0
+HEATER_A = 0.3
+
+
+class Scheduler:
+    """main/load.c: None for max_loads means power_update() starts loads unaided."""
+
+    def __init__(self, max_loads, gap):
+        self.max_loads = max_loads
+        self.gap = gap
+        self.state = [["idle", "idle"], ["idle", "idle"]]
+        self.error = [0.0, 0.0]
+        self.last_start = None              # no load has started yet
+
+    def request(self, fridge, load):
+        if self.max_loads is None:
+            return True
+        if self.state[fridge][load] in ("granted", "on"):
+            self.state[fridge][load] = "on"
+            return True
+        self.state[fridge][load] = "waiting"
+        return False
+
+    def release(self, fridge, load):
+        self.state[fridge][load] = "idle"
+
+    def started(self, now):
+        self.last_start = now
+
+    def schedule(self, now):
+        if self.max_loads is None:
+            return
+        if any(s == "granted" for row in self.state for s in row):
+            return
+        if self.last_start is not None and now - self.last_start < self.gap:
+            return
+        for load in (COMPRESSOR, HEATER):
+            states = [self.state[f][load] for f in (0, 1)]
+            active = sum(s in ("granted", "on") for s in states)
+            waiting = [f for f in (0, 1) if states[f] == "waiting"]
+            if waiting and active < self.max_loads[load]:
+                best = max(waiting, key=lambda f: abs(self.error[f]))
+                self.state[best][load] = "granted"
+                return
+
+
+class Fridge:
+    def __init__(self, set_temp, beer, ambient, wall_tau, beer_tau, cooling, heating, ferment):
+        self.set_temp = set_temp
+        self.beer = beer
+        self.air = beer
+        self.ambient = ambient
+        self.wall_tau = wall_tau
+        self.beer_tau = beer_tau
+        self.cooling = cooling              # degrees C per second at the evaporator
+        self.heating = heating
+        self.ferment = ferment              # degrees C per second of fermentation heat in the beer
+        self.state = OFF
+        self.earliest_cooling_start = 0
+        self.earliest_cooling_stop = 0
+        self.latest_cooling_stop = 0
+        self.earliest_heating_start = 0
+        self.settled = False
+        self.errors = []
+
+    def step(self, dt):
+        compressor = self.state in (COOLING, COOL_OVERRUN)
+        heater = self.state == HEATING
+        d_air = (self.ambient - self.air) / self.wall_tau + (self.beer - self.air) / self.beer_tau
+        d_air += -self.cooling if compressor else 0
+        d_air += self.heating if heater else 0
+        d_beer = (self.air - self.beer) / (self.beer_tau * 20) + self.ferment
+        self.air += d_air * dt
+        self.beer += d_beer * dt
+        if abs(self.beer - self.set_temp) < 0.1:
+            self.settled = True
+        if self.settled:
+            self.errors.append(self.beer - self.set_temp)
+
+    def cooling_needed(self, cool_offset=4.0):
+        return self.beer > self.set_temp and self.air > self.beer - cool_offset
+
+    def heating_needed(self, heat_offset=2.0):
+        return self.beer < self.set_temp and self.air < self.beer + heat_offset
+
+
+def power_update(fridge, num, scheduler, now, starts):
+    """main/power.c power_update(): appends (num, load) to starts for each switch-on."""
+    cool = fridge.cooling_needed()
+    heat = fridge.heating_needed()
+    s = fridge.state
+    if s == OFF:
+        if not (cool and heat):
+            if cool:
+                fridge.state = COOL_REQUESTED
+            if heat:
+                fridge.state = HEAT_REQUESTED
+    elif s == COOL_REQUESTED:
+        if not cool:
+            scheduler.release(num, COMPRESSOR)
+            fridge.state = OFF
+        elif now >= fridge.earliest_cooling_start and scheduler.request(num, COMPRESSOR):
+            fridge.earliest_cooling_stop = now + MIN_COOLING_TIME
+            fridge.latest_cooling_stop = now + MAX_COOLING_TIME
+            starts.append((num, COMPRESSOR))
+            scheduler.started(now)
+            fridge.state = COOLING
+    elif s == COOLING:
+        if not cool:
+            fridge.state = COOL_OVERRUN
+        elif now >= fridge.latest_cooling_stop:
+            fridge.earliest_cooling_start = now + MIN_OFF_TIME
+            fridge.earliest_heating_start = now + MIN_OFF_TIME
+            scheduler.release(num, COMPRESSOR)
+            fridge.state = OFF
+    elif s == COOL_OVERRUN:
+        if cool:
+            fridge.state = COOLING
+        elif now >= fridge.earliest_cooling_stop:
+            fridge.earliest_cooling_start = now + MIN_OFF_TIME
+            fridge.earliest_heating_start = now + MIN_OFF_TIME
+            scheduler.release(num, COMPRESSOR)
+            fridge.state = OFF
+    elif s == HEAT_REQUESTED:
+        if not heat:
+            scheduler.release(num, HEATER)
+            fridge.state = OFF
+        elif now >= fridge.earliest_heating_start and scheduler.request(num, HEATER):
+            starts.append((num, HEATER))
+            scheduler.started(now)
+            fridge.state = HEATING
+    elif s == HEATING:
+        if not heat:
+            fridge.earliest_cooling_start = now + MIN_OFF_TIME
+            scheduler.release(num, HEATER)
+            fridge.state = OFF
+
+
+def run(args, max_loads):
+    fridges = [
+        Fridge(18.0, 22.0, args.ambient, 900, 300, 0.02, 0.01, 0.0),
+        Fridge(12.0, 20.0, args.ambient, 700, 250, 0.025, 0.01, 0.00005),
+    ]
+    scheduler = Scheduler(max_loads, args.gap)
+    peak_a = 0.0
+    coincident = 0
+    total_starts = 0
+    last_start_time = -math.inf
+
+    for now in range(0, int(args.hours * 3600), CONTROL_PERIOD):
+        starts = []
+        for num, fridge in enumerate(fridges):
+            scheduler.error[num] = fridge.beer - fridge.set_temp
+        for num, fridge in enumerate(fridges):
+            power_update(fridge, num, scheduler, now, starts)
+        scheduler.schedule(now)
+
+        current = 0.0
+        for fridge in fridges:
+            current += COMPRESSOR_A if fridge.state in (COOLING, COOL_OVERRUN) else 0
+            current += HEATER_A if fridge.state == HEATING else 0
+        current += (COMPRESSOR_INRUSH_A - COMPRESSOR_A) * sum(load == COMPRESSOR for _, load in starts)
+        peak_a = max(peak_a, current)
+
+        total_starts += len(starts)
+        if starts:
+            if len(starts) > 1 or now - last_start_time < args.gap:
+                coincident += len(starts)
+            last_start_time = now
+
+        for fridge in fridges:
+            fridge.step(CONTROL_PERIOD)
+
+    errors = [e for fridge in fridges for e in fridge.errors]
+    rms = math.sqrt(sum(e * e for e in errors) / len(errors)) if errors else float("nan")
+    worst = max((abs(e) for e in errors), default=float("nan"))
+    return peak_a, total_starts, coincident, rms, worst
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--hours", type=float, default=48)
+    parser.add_argument("--ambient", type=float, default=30.0, help="room temperature (C)")
+    parser.add_argument("--max-compressors", type=int, default=2)
+    parser.add_argument("--max-heaters", type=int, default=2)
+    parser.add_argument("--gap", type=int, default=LOAD_MIN_START_GAP, help="minimum start gap (s)")
+    args = parser.parse_args()
+
+    print("%-12s %8s %8s %11s %10s %10s" % ("", "peak A", "starts", "coincident", "rms err C", "max err C"))
+    for name, max_loads in (("independent", None), ("scheduled", (args.max_compressors, args.max_heaters))):
+        peak_a, starts, coincident, rms, worst = run(args, max_loads)
+        print("%-12s %8.1f %8d %11d %10.2f %10.2f" % (name, peak_a, starts, coincident, rms, worst))
+
+
+if __name__ == "__main__":
+    main()
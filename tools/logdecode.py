@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Decodes the binary log records sent by main/binlog.c.
+
+The format strings aren't on the device, so this needs the ELF file of the
+firmware that produced the log, eg.
+
+    python3 -m serial.tools.miniterm --raw /dev/ttyUSB0 115200 | tools/logdecode.py build/brewfridge.elf
+
+or, for a capture,
+
+    tools/logdecode.py build/brewfridge.elf capture.bin
+
+Text between the records (eg. from printf) is passed through unchanged.
+Needs pyelftools (pip install pyelftools).
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+SYNC = b"\xfe\xb1"
+HEADER = struct.Struct("<BBII")     # length, level, fmt, time
+LEVELS = "EWI"
+TIME_UNIT_S = 1024e-6
+
+# a printf conversion: flags, width, precision, length modifier and conversion
+SPEC = re.compile(r"%([-+ #0]*)(\d+|\*)?(?:\.(\d+|\*))?(hh|h|ll|l|z|j|t|L)?([diouxXeEfgGcspa%])")
+
+
+def load_strings(elf_path):
+    with open(elf_path, "rb") as f:
+        elf = ELFFile(f)
+        section = elf.get_section_by_name(".binlog")
+        if section is None:
+            sys.exit("%s has no .binlog section" % elf_path)
+        return section["sh_addr"], section.data()
+
+
+def format_string(strings, addr):
+    base, data = strings
+    offset = addr - base
+    if offset < 0 or offset >= len(data):
+        return None
+    end = data.find(b"\0", offset)
+    return data[offset:end].decode(errors="replace")
+
+
+def format_record(fmt, args):
+    """Formats the raw arguments as printf() would have done."""
+    out = []
+    pos = 0
+    last = 0
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        if conv == "s":
+            n = args[pos]
+            value = args[pos + 1:pos + 1 + n].decode(errors="replace")
+            pos += 1 + n
+        elif conv in "eEfgGa":
+            (value,) = struct.unpack_from("<d", args, pos)
+            pos += 8
+        elif length == "ll":
+            (value,) = struct.unpack_from("<q" if conv in "di" else "<Q", args, pos)
+            pos += 8
+        else:
+            (value,) = struct.unpack_from("<i" if conv in "di" else "<I", args, pos)
+            pos += 4
+        if conv == "c":
+            value = chr(value & 0xff)
+        elif conv == "p":
+            conv = "x"
+            flags, width = "#", None
+        elif conv == "u":
+            conv = "d"
+        elif conv == "a":
+            conv = "e"
+        spec = "%" + flags + (width or "") + ("." + precision if precision else "") + conv
+        out.append(spec % value)
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def decode(strings, data, out):
+    """Decodes the records in `data`, and returns any incomplete tail."""
+    pos = 0
+    while True:
+        start = data.find(SYNC, pos)
+        if start < 0:
+            keep = 1 if data.endswith(SYNC[:1]) else 0
+            out.write(data[pos:len(data) - keep].decode(errors="replace"))
+            return data[len(data) - keep:]
+        out.write(data[pos:start].decode(errors="replace"))
+
+        body = start + len(SYNC)
+        if body + HEADER.size > len(data):
+            return data[start:]
+        length, level, addr, time = HEADER.unpack_from(data, body)
+        fmt = format_string(strings, addr)
+        if fmt is None or length < HEADER.size:
+            out.write(data[start:body].decode(errors="replace"))    # not a record after all
+            pos = body
+            continue
+        if body + length > len(data):
+            return data[start:]
+
+        args = data[body + HEADER.size:body + length]
+        try:
+            text = format_record(fmt, args)
+        except (struct.error, IndexError, TypeError, ValueError):
+            text = "(bad arguments for '%s')" % fmt
+        level = LEVELS[level] if level < len(LEVELS) else "?"
+        out.write("%s (%.3f) %s\n" % (level, time * TIME_UNIT_S, text))
+        pos = body + length
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="the firmware ELF file")
+    parser.add_argument("capture", nargs="?", help="serial capture (default stdin)")
+    args = parser.parse_args()
+
+    strings = load_strings(args.elf)
+    source = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+    pending = b""
+    with source:
+        while True:
+            chunk = source.read1(4096) if hasattr(source, "read1") else source.read(4096)
+            if not chunk:
+                break
+            pending = decode(strings, pending + chunk, sys.stdout)
+            sys.stdout.flush()
+    if pending:
+        sys.stdout.write(pending.decode(errors="replace"))
+
+
+if __name__ == "__main__":
+    main()
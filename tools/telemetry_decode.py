@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+"""Decodes the telemetry stream from main/telemetry.c into CSV files.
+
+Each message type goes to its own file in the output directory, one column
+per field:
+
+    temps.csv       time_ms, seq, addr, temp
+    power.csv       time_ms, seq, fridge, from, to
+    setpoints.csv   time_ms, seq, field, value
+    metrics.csv     time_ms, seq, metric, count, min_us, p99_us, max_us
+    energy.csv      time_ms, seq, fridge, window, period_s, starts, forced_stops,
+                    compressor_s, heater_s, blocked_s, wh
+    history.csv     time_ms, seq, field, window, period_s, min, max, mean,
+                    above_s, below_s
+
+Read from the serial port (needs pyserial) or a capture:
+
+    tools/telemetry_decode.py --port /dev/ttyUSB1 -o logs/
+    tools/telemetry_decode.py capture.bin -o logs/
+
+Files are appended to, so a log can be built up over several runs.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+
+# must match main/telemetry.h, main/types.h, main/metrics.h, main/energy.h and main/history.h
+TEMP_DATA, POWER_STATE, SETPOINT, METRICS, ENERGY, HISTORY = range(1, 7)
+POWER_STATES = ["off", "cool_requested", "cooling", "cool_overrun", "heat_requested", "heating"]
+SET_FIELDS = ["F1_SET", "F2_SET", "F1_COOL", "F2_COOL", "F1_HEAT", "F2_HEAT"]
+METRIC_NAMES = ["sensor_scan", "conversion_wait", "scratchpad_read", "ui_loop", "lcd_flush", "sample_to_control",
+                "control_jitter", "encoder_jitter", "mqtt_per_frame"]
+COUNTER_NAMES = ["temp_queue_full", "telemetry_dropped", "control_overrun", "sensor_overrun", "failsafe",
+                 "mqtt_dropped"]
+SENSOR_FIELDS = ["F1_BEER", "F1_AIR", "F1_HEAT", "F2_BEER", "F2_AIR", "F2_HEAT"]
+WINDOWS = ["1h", "24h", "7d"]
+ENERGY_STATS = struct.Struct("<7I")
+HISTORY_STATS = struct.Struct("<3h3I")
+UNDEFINED_TEMP = -999
+HEADER = struct.Struct("<BBI")
+
+COLUMNS = {
+    TEMP_DATA: ("temps", ["time_ms", "seq", "addr", "temp"]),
+    POWER_STATE: ("power", ["time_ms", "seq", "fridge", "from", "to"]),
+    SETPOINT: ("setpoints", ["time_ms", "seq", "field", "value"]),
+    METRICS: ("metrics", ["time_ms", "seq", "metric", "count", "min_us", "p99_us", "max_us"]),
+    ENERGY: ("energy", ["time_ms", "seq", "fridge", "window", "period_s", "starts", "forced_stops",
+                        "compressor_s", "heater_s", "blocked_s", "wh"]),
+    HISTORY: ("history", ["time_ms", "seq", "field", "window", "period_s", "min", "max", "mean",
+                          "above_s", "below_s"]),
+}
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE."""
+    crc = 0xffff
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xffff
+    return crc
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    pos = 0
+    while pos < len(frame):
+        code = frame[pos]
+        if code == 0 or pos + code > len(frame):
+            raise ValueError("bad COBS frame")
+        out += frame[pos + 1:pos + code]
+        pos += code
+        if code != 0xff and pos < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def rows(msg):
+    """Turns a message into (type, rows)."""
+    kind, seq, time_ms = HEADER.unpack_from(msg)
+    body = msg[HEADER.size:]
+    if kind == TEMP_DATA:
+        result = []
+        for i in range(body[0]):
+            addr, temp = struct.unpack_from("<Qh", body, 1 + i * 10)
+            result.append([time_ms, seq, "%016x" % addr, "" if temp == -32768 else temp / 16])
+        return kind, result
+    if kind == POWER_STATE:
+        fridge, old, new = body[:3]
+        name = lambda s: POWER_STATES[s] if s < len(POWER_STATES) else s
+        return kind, [[time_ms, seq, fridge + 1, name(old), name(new)]]
+    if kind == SETPOINT:
+        field = body[0]
+        (value,) = struct.unpack_from("<h", body, 1)
+        name = SET_FIELDS[field] if field < len(SET_FIELDS) else field
+        return kind, [[time_ms, seq, name, "off" if value == UNDEFINED_TEMP else value / 10]]
+    if kind == METRICS:
+        result = []
+        for i, metric in enumerate(METRIC_NAMES):
+            result.append([time_ms, seq, metric] + list(struct.unpack_from("<4I", body, i * 16)))
+        base = len(METRIC_NAMES) * 16
+        for i, counter in enumerate(COUNTER_NAMES):
+            (count,) = struct.unpack_from("<I", body, base + i * 4)
+            result.append([time_ms, seq, counter, count, "", "", ""])
+        return kind, result
+    if kind == ENERGY:
+        result = []
+        for i, window in enumerate(WINDOWS):
+            stats = ENERGY_STATS.unpack_from(body, 1 + i * ENERGY_STATS.size)
+            result.append([time_ms, seq, body[0] + 1, window] + list(stats))
+        return kind, result
+    if kind == HISTORY:
+        result = []
+        field = SENSOR_FIELDS[body[0]] if body[0] < len(SENSOR_FIELDS) else body[0]
+        temp = lambda t: "" if t == -32768 else t / 16
+        for i, window in enumerate(WINDOWS):
+            lo, hi, mean, above_s, below_s, period_s = HISTORY_STATS.unpack_from(body, 1 + i * HISTORY_STATS.size)
+            result.append([time_ms, seq, field, window, period_s, temp(lo), temp(hi), temp(mean), above_s, below_s])
+        return kind, result
+    return None, []
+
+
+class Writer:
+    def __init__(self, directory):
+        os.makedirs(directory, exist_ok=True)
+        self.files = {}
+        self.writers = {}
+        for kind, (name, columns) in COLUMNS.items():
+            path = os.path.join(directory, name + ".csv")
+            new = not os.path.exists(path) or os.path.getsize(path) == 0
+            self.files[kind] = open(path, "a", newline="")
+            self.writers[kind] = csv.writer(self.files[kind])
+            if new:
+                self.writers[kind].writerow(columns)
+        self.last_seq = None
+        self.bad = 0
+        self.lost = 0
+
+    def frame(self, frame):
+        try:
+            msg = cobs_decode(frame)
+        except ValueError:
+            self.bad += 1
+            return
+        if len(msg) < HEADER.size + 2 or crc16(msg[:-2]) != struct.unpack_from("<H", msg, len(msg) - 2)[0]:
+            self.bad += 1
+            return
+        msg = msg[:-2]
+        seq = msg[1]
+        if self.last_seq is not None:
+            self.lost += (seq - self.last_seq - 1) % 256
+        self.last_seq = seq
+        try:
+            kind, result = rows(msg)
+        except (struct.error, IndexError):
+            self.bad += 1
+            return
+        if kind is not None:
+            self.writers[kind].writerows(result)
+            self.files[kind].flush()
+
+    def close(self):
+        for f in self.files.values():
+            f.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="capture file (default stdin)")
+    parser.add_argument("--port", help="serial port to read instead")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("-o", "--output", default=".", help="directory for the CSV files")
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        source = serial.Serial(args.port, args.baud)
+        read = lambda: source.read(max(1, source.in_waiting))
+    else:
+        source = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+        read = lambda: source.read(4096)
+
+    writer = Writer(args.output)
+    pending = b""
+    try:
+        while True:
+            chunk = read()
+            if not chunk:
+                break
+            *frames, pending = (pending + chunk).split(b"\0")
+            for frame in frames:
+                if frame:
+                    writer.frame(frame)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        writer.close()
+        print("%d bad frames, %d messages lost" % (writer.bad, writer.lost), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Converts a brewfridge trace into Chrome trace JSON.
+
+Build with TRACE_ENABLE set to ON in CMakeLists.txt, capture the serial port
+to a file while pressing 't' on the console, eg.
+
+    python3 -m serial.tools.miniterm --raw /dev/ttyUSB0 115200 > capture.bin
+
+and convert it with
+
+    tools/trace2json.py capture.bin > trace.json
+
+then open trace.json in chrome://tracing or https://ui.perfetto.dev. Any text
+around the trace in the capture is ignored. If the capture holds several
+traces, the last one is used.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"BTRC"
+VERSION = 1
+NAME_LEN = 16
+RECORD = struct.Struct("<IBBH")     # time_us, type, a, b
+
+# must match main/trace.h
+TASK_SWITCH, QUEUE_SEND, QUEUE_RECEIVE, ONEWIRE_BEGIN, ONEWIRE_END, I2C_WRITE, RELAY = range(7)
+QUEUES = ["temperature_queue", "encoder_event_queue"]
+ONEWIRE = ["scan", "convert", "read", "alarm search", "set alarm"]
+OUTPUTS = ["F1 relay", "F2 relay", "F1 SSR", "F2 SSR"]
+
+PID = 1
+TID_CORE = 0                        # plus the core number
+TID_QUEUES = 10
+TID_ONEWIRE = 11
+TID_I2C = 12
+TID_OUTPUTS = 13
+
+
+def parse(data):
+    start = data.rfind(MAGIC)
+    if start < 0:
+        sys.exit("no trace found")
+    version, num_tasks, num_records = struct.unpack_from("<BBH", data, start + 4)
+    if version != VERSION:
+        sys.exit("unsupported trace version %d" % version)
+
+    pos = start + 8
+    tasks = {}
+    for _ in range(num_tasks):
+        task_id = data[pos]
+        name = data[pos + 1:pos + 1 + NAME_LEN].split(b"\0")[0].decode(errors="replace")
+        tasks[task_id] = name
+        pos += 1 + NAME_LEN
+
+    records = []
+    last = None
+    offset = 0
+    for i in range(num_records):
+        if pos + RECORD.size > len(data):
+            print("trace truncated after %d of %d records" % (i, num_records), file=sys.stderr)
+            break
+        time_us, kind, a, b = RECORD.unpack_from(data, pos)
+        pos += RECORD.size
+        if last is not None and time_us + offset < last - (1 << 31):
+            offset += 1 << 32       # the 32 bit timestamp wrapped (a small step back isn't a wrap)
+        last = time_us + offset
+        records.append((last, kind, a, b))
+    return tasks, records
+
+
+def convert(tasks, records):
+    events = [
+        {"ph": "M", "pid": PID, "name": "process_name", "args": {"name": "brewfridge"}},
+        {"ph": "M", "pid": PID, "tid": TID_QUEUES, "name": "thread_name", "args": {"name": "queues"}},
+        {"ph": "M", "pid": PID, "tid": TID_ONEWIRE, "name": "thread_name", "args": {"name": "1-Wire"}},
+        {"ph": "M", "pid": PID, "tid": TID_I2C, "name": "thread_name", "args": {"name": "I2C"}},
+        {"ph": "M", "pid": PID, "tid": TID_OUTPUTS, "name": "thread_name", "args": {"name": "outputs"}},
+    ]
+    if not records:
+        return events
+    t0 = records[0][0]
+    running = {}                    # core -> (task name, start time)
+    cores = set()
+
+    for time_us, kind, a, b in records:
+        ts = time_us - t0
+        if kind == TASK_SWITCH:
+            cores.add(a)
+            if a in running:
+                name, since = running[a]
+                events.append({"ph": "X", "pid": PID, "tid": TID_CORE + a, "name": name,
+                               "ts": since, "dur": ts - since})
+            running[a] = (tasks.get(b, "task %d" % b), ts)
+        elif kind in (QUEUE_SEND, QUEUE_RECEIVE):
+            queue = QUEUES[a] if a < len(QUEUES) else "queue %d" % a
+            op = "send" if kind == QUEUE_SEND else "receive"
+            events.append({"ph": "i", "s": "t", "pid": PID, "tid": TID_QUEUES, "ts": ts,
+                           "name": "%s %s" % (op, queue)})
+        elif kind in (ONEWIRE_BEGIN, ONEWIRE_END):
+            name = ONEWIRE[a] if a < len(ONEWIRE) else "1-Wire %d" % a
+            event = {"ph": "B" if kind == ONEWIRE_BEGIN else "E", "pid": PID, "tid": TID_ONEWIRE,
+                     "ts": ts, "name": name}
+            if kind == ONEWIRE_END:
+                event["args"] = {"err": b}
+            events.append(event)
+        elif kind == I2C_WRITE:
+            events.append({"ph": "i", "s": "t", "pid": PID, "tid": TID_I2C, "ts": ts,
+                           "name": "write" if b == 0 else "write failed", "args": {"data": "0x%02x" % a}})
+        elif kind == RELAY:
+            name = OUTPUTS[a] if a < len(OUTPUTS) else "output %d" % a
+            events.append({"ph": "i", "s": "g", "pid": PID, "tid": TID_OUTPUTS, "ts": ts,
+                           "name": "%s %s" % (name, "on" if b else "off")})
+            events.append({"ph": "C", "pid": PID, "ts": ts, "name": name, "args": {"on": b}})
+
+    end = records[-1][0] - t0
+    for core, (name, since) in running.items():
+        events.append({"ph": "X", "pid": PID, "tid": TID_CORE + core, "name": name,
+                       "ts": since, "dur": end - since})
+    for core in sorted(cores):
+        events.append({"ph": "M", "pid": PID, "tid": TID_CORE + core, "name": "thread_name",
+                       "args": {"name": "core %d" % core}})
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="serial capture holding a binary trace")
+    parser.add_argument("-o", "--output", help="output file (default stdout)")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        tasks, records = parse(f.read())
+    trace = {"traceEvents": convert(tasks, records), "displayTimeUnit": "ms"}
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()